@@ -0,0 +1,74 @@
+/**
+ * @file   image_pipeline.hpp
+ * @author Dennis Sitelew
+ * @date   Oct. 16, 2026
+ *
+ * Three-stage image transfer pipeline: the image client receives compressed blocks, a decoder thread decompresses
+ * them, and a writer thread pushes the pixels to the display. The stages are connected with message queues, so the
+ * network, the CPU and the SPI bus are all busy at the same time.
+ */
+#pragma once
+
+#include <hei/common.hpp>
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+#include <autoconf.h>
+
+namespace hei::image_pipeline {
+
+enum class encoding : std::uint8_t {
+   //! Independent LZ4 block
+   lz4,
+
+   //! LZ4 block compressed using the pixel data of the previously submitted block as the dictionary
+   lz4_linked,
+
+   //! Repeated 16-bit word, nothing to decompress
+   fill,
+
+   //! Uncompressed pixel data, filled by the receiver
+   raw,
+};
+
+//! A single image block travelling through the pipeline stages
+struct block {
+   encoding type;
+
+   //! Compressed data, filled by the receiver
+   std::array<std::uint8_t, CONFIG_APP_IMAGE_CLIENT_RECV_BUFFER_SIZE> compressed;
+   std::uint16_t compressed_size;
+
+   //! Pixel data for the fill blocks (first byte in the lower half)
+   std::uint16_t fill_word;
+
+   //! Decompressed pixel data, filled by the decoder. Points to a display driver transmit buffer, so the writer can
+   //! pass it to the SPI driver without copying.
+   std::span<std::uint8_t> pixels;
+   std::uint16_t uncompressed_size;
+};
+
+//! Start a new transfer. Should be called after the display is ready to accept pixel data.
+//! Takes a display driver transmit buffer for every block, until @ref end is called.
+//! @return An error if the display driver has run out of transmit buffers.
+void_t begin();
+
+//! Get a free block to receive the next compressed block into.
+//! Blocks until one of the downstream stages is done with a block.
+//! @return An error if any of the pipeline stages has failed since the last call to @ref begin.
+expected<block *> acquire();
+
+//! Pass a filled block on to the decoder
+void submit(block &b);
+
+//! Return an acquired block without submitting it (e.g. after a receive error)
+void release(block &b);
+
+//! Signal the end of the transfer and wait until all the submitted blocks are written to the display.
+//! Returns the transmit buffers to the display driver.
+//! @return The first error encountered by any of the pipeline stages.
+void_t end();
+
+} // namespace hei::image_pipeline
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <it8951/common.hpp>
+
 #include <array>
 #include <chrono>
 #include <cstdint>
@@ -43,8 +45,35 @@ std::optional<std::chrono::seconds> refresh_interval();
 
 bool set(const_span_t address, std::uint16_t port, std::uint32_t interval);
 
+//! No wake-ups between these times (in minutes since midnight, local time). Start == end - no quiet hours.
+std::uint16_t quiet_start();
+std::uint16_t quiet_end();
+bool set_quiet_hours(std::uint16_t start, std::uint16_t end);
+
+//! Fingerprint of the last image shown on the display (0 - no image yet)
+std::uint32_t image_fingerprint();
+bool set_image_fingerprint(std::uint32_t fingerprint);
+
 } // namespace image_server
 
+namespace display {
+
+//! Transfer settings found by the display calibration (0 - not calibrated yet)
+std::uint32_t spi_frequency();
+std::uint16_t burst_size();
+
+bool set_calibration(std::uint32_t spi_frequency, std::uint16_t burst_size);
+
+//! Pixel formats written directly into the image buffer, a bitmask of BIT(it8951::common::pixel_format)
+std::uint8_t direct_formats();
+bool set_direct_formats(std::uint8_t formats);
+
+//! Panel information cached by the first display start, to skip the panel reset afterwards (width 0 - not cached)
+it8951::common::panel_info panel_info();
+bool set_panel_info(const it8951::common::panel_info &info);
+
+} // namespace display
+
 bool configured();
 
 } // namespace hei::settings
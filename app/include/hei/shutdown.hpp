@@ -6,9 +6,27 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
+#include <optional>
 
 namespace hei::shutdown {
 
-void request(std::chrono::seconds duration);
+//! Current local time (in seconds since midnight), e.g. as reported by the image server. Passed on to the power board
+//! with the shutdown requests, so that it can keep the quiet hours even without hearing from us again.
+void set_time_of_day(std::uint32_t seconds);
+
+//! Ask the power board to cut the power for the duration. The wake-up is delayed until the end of the quiet hours,
+//! if it would fall into them (see hei::settings::image_server::quiet_start()).
+//! @return true if the power board has acknowledged the request within the timeout
+bool request(std::chrono::seconds duration, std::chrono::milliseconds ack_timeout);
+
+//! Ask the power board how many times it had to cut the power on its own since the last shutdown request, because we
+//! have exceeded the awake budget
+//! @return std::nullopt if the power board hasn't answered within the timeout
+std::optional<std::uint16_t> forced_cutoffs(std::chrono::milliseconds ack_timeout);
+
+//! Keep the power board from cutting the power after its awake budget (e.g. while hosting the setup access point) by
+//! sending it status requests every APP_SHUTDOWN_KEEP_ALIVE_INTERVAL seconds
+void keep_alive(bool enable);
 
 } // namespace hei::shutdown
@@ -0,0 +1,110 @@
+/**
+ * @file   socket_reader.hpp
+ * @author Dennis Sitelew
+ * @date   Oct. 16, 2026
+ */
+#pragma once
+
+#include <hei/common.hpp>
+
+#include <array>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <span>
+#include <tuple>
+#include <utility>
+
+#include <autoconf.h>
+
+namespace hei {
+
+/**
+ * Buffered reader for non-blocking stream sockets.
+ *
+ * Data is read from the socket in chunks as big as the ring buffer allows. The typed parsers are then served from the
+ * buffer, so reading a whole message header usually costs a single select() and read() instead of one per field.
+ */
+class socket_reader {
+public:
+   explicit socket_reader(std::chrono::seconds timeout);
+
+public:
+   //! Start reading from a new socket, dropping any buffered data
+   void reset(int socket);
+
+   //! Read exactly target.size() bytes
+   [[nodiscard]] void_t read(std::span<std::uint8_t> target);
+
+   //! Drop the next num_bytes bytes (e.g. unknown trailing message fields)
+   [[nodiscard]] void_t skip(std::size_t num_bytes);
+
+   //! Read a little-endian encoded unsigned integer
+   template <std::unsigned_integral T>
+   expected<T> read() {
+      constexpr auto size = sizeof(T);
+      std::array<std::uint8_t, size> buffer{};
+      if (auto res = read(buffer); !res) {
+         return tl::unexpected(res.error());
+      }
+
+      T result{};
+      for (std::size_t i = 0; i < size; ++i) {
+         result |= static_cast<T>(static_cast<T>(buffer[i]) << (i * 8));
+      }
+
+      return result;
+   }
+
+   //! Read a tuple of little-endian encoded unsigned integers
+   template <typename Tuple>
+   expected<Tuple> read_tuple() {
+      Tuple res;
+      const auto op_res = read_tuple_impl(res, std::make_index_sequence<std::tuple_size_v<Tuple>>{});
+      if (!op_res) {
+         return tl::unexpected{op_res.error()};
+      }
+      return res;
+   }
+
+private:
+   template <typename Tuple, std::size_t I>
+   bool read_tuple_element(Tuple &t, std::error_code &ec) {
+      using element_t = std::tuple_element_t<I, Tuple>;
+      if (auto res = read<element_t>()) {
+         std::get<I>(t) = res.value();
+         return true;
+      } else {
+         ec = res.error();
+         return false;
+      }
+   }
+
+   template <typename Tuple, std::size_t... I>
+   void_t read_tuple_impl(Tuple &t, std::index_sequence<I...>) {
+      std::error_code ec;
+      if (const bool success = (read_tuple_element<Tuple, I>(t, ec) && ...); !success) {
+         return tl::unexpected{ec};
+      }
+      return {};
+   }
+
+   //! Copy as much buffered data as possible into the target
+   std::size_t take(std::span<std::uint8_t> target);
+
+   //! Wait for the incoming data and read as much of it as fits into the buffer
+   void_t fill();
+
+   //! Wait for the incoming data and read as much of it as fits into the target
+   expected<std::size_t> receive_some(std::span<std::uint8_t> target);
+
+private:
+   int socket_{-1};
+   std::chrono::seconds timeout_;
+
+   std::array<std::uint8_t, CONFIG_APP_SOCKET_READER_BUFFER_SIZE> buffer_{};
+   std::size_t head_{0}; //! Position of the first buffered byte
+   std::size_t size_{0}; //! Number of buffered bytes
+};
+
+} // namespace hei
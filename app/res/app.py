@@ -107,7 +107,7 @@ def image_server_config():
         return '{"result": "error", "message": "Missing refresh interval"}'
 
     interval = int(config['interval'])
-    if interval < 120 or interval > 3600:
+    if interval < 10 or interval > 604800:
         return '{"result": "error", "message": "Bad refresh interval"}'
 
     print(f"Config: {config}")
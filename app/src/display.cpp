@@ -5,6 +5,7 @@
  */
 
 #include <hei/display.hpp>
+#include <hei/settings.hpp>
 
 #include <it8951/display.hpp>
 
@@ -24,6 +25,57 @@ namespace {
 const struct device *const display_driver = DEVICE_DT_GET_ONE(ite_it8951);
 it8951::display display{*display_driver};
 
+zephyr::void_t calibrate() {
+   return ::display.calibrate().and_then([](const auto &res) -> zephyr::void_t {
+      if (!hei::settings::display::set_calibration(res.spi_frequency, res.burst_size)) {
+         LOG_WRN("Error saving the display calibration");
+      }
+      return {};
+   });
+}
+
+zephyr::void_t start() {
+   const auto cached = hei::settings::display::panel_info();
+
+   std::optional<it8951::common::panel_info> opt_cached;
+   if (cached.width != 0) {
+      opt_cached = cached;
+   }
+
+   return ::display.start(opt_cached).and_then([&]() -> zephyr::void_t {
+      // Only written on the first start, or if the panel has changed
+      if (const auto info = ::display.info(); info != cached) {
+         if (!hei::settings::display::set_panel_info(info)) {
+            LOG_WRN("Error saving the display info");
+         }
+      }
+      return {};
+   });
+}
+
+void setup_transfers() {
+   ::display.set_direct_writes(hei::settings::display::direct_formats());
+
+   const it8951::common::calibration cached{
+      .spi_frequency = hei::settings::display::spi_frequency(),
+      .burst_size = hei::settings::display::burst_size(),
+   };
+
+   if (cached.spi_frequency != 0) {
+      ::display.apply(cached).or_else([](const auto &ec) {
+         LOG_WRN("Error applying the display calibration: %s", ec.message().c_str());
+      });
+      return;
+   }
+
+#if CONFIG_APP_DISPLAY_CALIBRATION
+   // Only done once, running with the safe defaults on failure
+   calibrate().or_else([](const auto &ec) {
+      LOG_WRN("Display calibration error: %s", ec.message().c_str());
+   });
+#endif
+}
+
 } // namespace
 
 namespace hei::display {
@@ -34,6 +86,12 @@ bool init() {
       return false;
    }
 
+   if (auto res = start(); !res) {
+      LOG_ERR("Display start error: %s", res.error().message().c_str());
+      return false;
+   }
+
+   setup_transfers();
    return true;
 }
 
@@ -47,6 +105,13 @@ it8951::display &get() {
 
 namespace {
 
+//! The panel no longer shows the image the server has sent us, so it shouldn't be considered as not modified
+void forget_shown_image() {
+   if (!hei::settings::image_server::set_image_fingerprint(0)) {
+      LOG_WRN("Error resetting the image fingerprint");
+   }
+}
+
 template <typename T>
 bool shell_parse(const shell *sh, const char *arg, const char *name, int base, T &out) {
    auto handle_err = [&](int err, auto value) {
@@ -128,15 +193,10 @@ int shell_do_fill(const shell *sh, size_t argc, const char **argv) {
    }
    LOG_HEXDUMP_INF(as_bytes.data(), as_bytes.size(), "Pattern");
 
-   auto width = display.width();
-
-   auto fr = ::display.fill_screen(
-      [&](auto x, auto y) -> std::uint8_t {
-         const auto idx = ((width * y) + x);
-         return as_bytes[idx % as_bytes.size()];
-      },
-      mode);
+   auto fr = ::display.fill_pattern(as_bytes, mode);
 
+   // Even a failed fill might have changed the panel contents
+   forget_shown_image();
    if (!fr) {
       shell_error(sh, "Error filling the screen: %s", fr.error().message().c_str());
       return -EINVAL;
@@ -151,6 +211,7 @@ int shell_do_clear(const shell *sh, size_t argc, const char **argv) {
    ARG_UNUSED(argv);
 
    auto cr = ::display.clear();
+   forget_shown_image();
    if (!cr) {
       shell_error(sh, "Error cleaning screen: %s", cr.error().message().data());
       return -1;
@@ -159,6 +220,83 @@ int shell_do_clear(const shell *sh, size_t argc, const char **argv) {
    return 0;
 }
 
+int shell_do_read(const shell *sh, size_t argc, const char **argv) {
+   ARG_UNUSED(argc);
+
+   auto opt_x = shell_parse<std::uint16_t>(sh, argv[1], "x", 10);
+   auto opt_y = shell_parse<std::uint16_t>(sh, argv[2], "y", 10);
+   auto opt_width = shell_parse<std::uint16_t>(sh, argv[3], "width", 10);
+   auto opt_height = shell_parse<std::uint16_t>(sh, argv[4], "height", 10);
+   if (!opt_x || !opt_y || !opt_width || !opt_height) {
+      return -EINVAL;
+   }
+
+   std::array<std::uint8_t, 256> pixels{};
+   const it8951::common::image::area area{.x = *opt_x, .y = *opt_y, .width = *opt_width, .height = *opt_height};
+   if (static_cast<std::size_t>(area.width) * area.height > pixels.size()) {
+      shell_error(sh, "Area too big, at most %zu pixels", pixels.size());
+      return -EINVAL;
+   }
+
+   auto rr = ::display.read_area(area, pixels);
+   if (!rr) {
+      shell_error(sh, "Error reading the area: %s", rr.error().message().c_str());
+      return -1;
+   }
+
+   shell_hexdump(sh, pixels.data(), static_cast<std::size_t>(area.width) * area.height);
+   return 0;
+}
+
+int shell_do_calibrate(const shell *sh, size_t argc, const char **argv) {
+   ARG_UNUSED(argc);
+   ARG_UNUSED(argv);
+
+   auto cr = calibrate();
+   if (!cr) {
+      shell_error(sh, "Calibration error: %s", cr.error().message().c_str());
+      return -1;
+   }
+
+   shell_print(sh, "SPI clock: %" PRIu32 " Hz, burst size: %" PRIu16, hei::settings::display::spi_frequency(),
+               hei::settings::display::burst_size());
+   return 0;
+}
+
+int shell_do_benchmark(const shell *sh, size_t argc, const char **argv) {
+   ARG_UNUSED(argc);
+   ARG_UNUSED(argv);
+
+   using it8951::common::pixel_format;
+
+   std::uint8_t formats = 0;
+   for (auto format : {pixel_format::pf4bpp, pixel_format::pf8bpp}) {
+      const auto bpp = (format == pixel_format::pf4bpp) ? 4 : 8;
+
+      auto br = ::display.benchmark(format);
+      if (!br) {
+         shell_error(sh, "%dbpp benchmark error: %s", bpp, br.error().message().c_str());
+         return -1;
+      }
+
+      shell_print(sh, "%dbpp: load image area %" PRIu32 " ms, direct %" PRIu32 " ms%s", bpp, br->load_ms,
+                  br->direct_ms, br->verified ? "" : " (direct data mismatch)");
+
+      if (br->verified && br->direct_ms < br->load_ms) {
+         formats |= BIT(static_cast<unsigned>(format));
+      }
+   }
+
+   ::display.set_direct_writes(formats);
+   if (!hei::settings::display::set_direct_formats(formats)) {
+      shell_error(sh, "Error saving the direct write formats");
+      return -1;
+   }
+
+   shell_print(sh, "Direct write formats: 0x%02" PRIx8, formats);
+   return 0;
+}
+
 int dummy_help(const shell *sh, size_t argc, const char **argv) {
    if (argc == 1) {
       shell_help(sh);
@@ -184,6 +322,27 @@ Usage: fill <pattern> <mode>
                                              3,
                                              0),
                                SHELL_CMD_ARG(clear, NULL, "Clear the screen", shell_do_clear, 1, 0),
+                               SHELL_CMD_ARG(read,
+                                             NULL,
+                                             R"help(Read the pixels back from the display controller.
+Usage: read <x> <y> <width> <height>
+- <x>, <width> have to be even, at most 256 pixels)help",
+                                             shell_do_read,
+                                             5,
+                                             0),
+                               SHELL_CMD_ARG(calibrate,
+                                             NULL,
+                                             "Find the fastest reliable SPI clock and burst size, and save them",
+                                             shell_do_calibrate,
+                                             1,
+                                             0),
+                               SHELL_CMD_ARG(benchmark,
+                                             NULL,
+                                             R"help(Time full-screen writes with and without direct image buffer writes.
+Picks the faster verified path for every pixel format and saves it. Overwrites the image buffer.)help",
+                                             shell_do_benchmark,
+                                             1,
+                                             0),
                                SHELL_SUBCMD_SET_END);
 
 SHELL_SUBCMD_ADD((hei), display, &display_commands, "Display shell", dummy_help, 2, 0);
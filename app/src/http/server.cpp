@@ -334,7 +334,7 @@ public:
          return error_response("Bad server port");
       }
 
-      if (interval < 120 || interval > 3600) {
+      if (interval < 10 || interval > 604800) {
          return error_response("Bad refresh interval");
       }
 
@@ -8,8 +8,10 @@
 #include <hei/common.hpp>
 #include <hei/display.hpp>
 #include <hei/image_client.hpp>
+#include <hei/image_pipeline.hpp>
 #include <hei/settings.hpp>
 #include <hei/shutdown.hpp>
+#include <hei/socket_reader.hpp>
 
 #include <zephyr-cpp/error.hpp>
 
@@ -24,9 +26,11 @@
 
 #include <lz4.h>
 
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <span>
 #include <tuple>
-#include <utility>
 
 #include <autoconf.h>
 
@@ -51,35 +55,124 @@ K_EVENT_DEFINE(client_events)
 class image_client {
 private:
    enum class message_type : std::uint8_t {
-      get_image_request = 0x10,
       image_header_response = 0x11,
       image_block_response = 0x12,
+      image_not_modified = 0x13,
+      image_delta_response = 0x14,
+      image_area_response = 0x15,
+      image_linked_block_response = 0x16,
+      image_fill_block_response = 0x17,
+      get_image_request = 0x18,
+      session_response = 0x19,
+      image_tiled_response = 0x1A,
+      tile_band_response = 0x1B,
       server_error = 0x50,
    };
 
+   static constexpr std::uint8_t protocol_version = 2;
+
+   //! Codecs supported by the client (bitmask)
+   enum codec : std::uint8_t {
+      //! LZ4 blocks compressed using the previous block as the dictionary
+      codec_linked_blocks = BIT(0),
+
+      //! Runs of a repeated 16-bit word
+      codec_fill_blocks = BIT(1),
+   };
+
+   static constexpr std::uint8_t supported_codecs =
+      (IS_ENABLED(CONFIG_APP_IMAGE_CLIENT_LINKED_BLOCKS) ? codec_linked_blocks : 0) | codec_fill_blocks;
+
+   //! Optional protocol features supported by the client (bitmask)
+   enum feature : std::uint32_t {
+      //! Skip the image if the fingerprint matches
+      feature_not_modified = BIT(0),
+
+      //! Only send the changed areas of the image
+      feature_delta_updates = BIT(1),
+
+      //! Send every unique tile of the image only once
+      feature_tiled_frames = BIT(2),
+   };
+
+   static constexpr std::uint32_t supported_tiled_frames =
+      (CONFIG_APP_IMAGE_CLIENT_TILE_CACHE_SLOTS > 0) ? feature_tiled_frames : 0U;
+
+   static constexpr std::uint32_t supported_features =
+      feature_not_modified | feature_delta_updates | supported_tiled_frames;
+
+   //! Tiled frames: tile size in pixels, only 4bpp tiles are supported
+   static constexpr std::uint8_t tile_width = 16;
+   static constexpr std::uint8_t tile_height = 16;
+   static constexpr std::size_t tile_row_bytes = tile_width / 2;
+   static constexpr std::size_t tile_bytes = tile_row_bytes * tile_height;
+
+   using tile_t = std::array<std::uint8_t, tile_bytes>;
+
+   //! Pixel formats supported by the client (bitmask, indexed by the IT8951 pixel format value)
+   static constexpr std::uint8_t supported_pixel_formats =
+      BIT(static_cast<int>(it8951::common::pixel_format::pf2bpp)) |
+      BIT(static_cast<int>(it8951::common::pixel_format::pf3bpp)) |
+      BIT(static_cast<int>(it8951::common::pixel_format::pf4bpp)) |
+      BIT(static_cast<int>(it8951::common::pixel_format::pf8bpp));
+
+   //! Decompressed blocks should fit into a single display transmit buffer
+   static constexpr std::uint16_t max_block_size = std::min(CONFIG_EPD_TX_BUFFER_SIZE, 0xFFFF);
+
+   //! Parameters chosen by the server for the current request
+   struct session {
+      std::uint8_t codecs;
+      it8951::common::pixel_format pixel_format;
+      std::uint16_t block_size;
+      std::uint32_t features;
+
+      //! Seconds until the next change known to the server (0 - none)
+      std::uint32_t next_wake;
+   };
+
    struct get_image_request {
    public:
-      // type: u8, fg_valid: u8, runtime_to_empty: u32, runtime_to_full: u32, charge_percentage: u8, voltage: u32
-      static constexpr std::size_t array_size = 1 + 1 + 4 + 4 + 1 + 4;
+      // type: u8, version: u8, payload_size: u16, followed by the payload:
+      // fg_valid: u8, runtime_to_empty: u32, runtime_to_full: u32, charge_percentage: u8, voltage: u32,
+      // fingerprint: u32, codecs: u8, pixel_formats: u8, max_block_size: u16, features: u32, tile_cache_slots: u16,
+      // forced_cutoffs: u16
+      static constexpr std::size_t fuel_gauge_size = 4 + 4 + 1 + 4;
+      static constexpr std::size_t payload_size = 1 + fuel_gauge_size + 4 + 1 + 1 + 2 + 4 + 2 + 2;
+      static constexpr std::size_t array_size = 1 + 1 + 2 + payload_size;
       using array_t = std::array<std::uint8_t, array_size>;
 
    public:
-      get_image_request() {
+      explicit get_image_request(std::uint16_t forced_cutoffs) {
          auto it = payload.begin();
          write(it, static_cast<std::uint8_t>(message_type::get_image_request));
+         write(it, protocol_version);
+         write(it, static_cast<std::uint16_t>(payload_size));
 
          // ReSharper disable once CppUseStructuredBinding
          const auto fg = hei_fuel_gauge_get();
          write(it, static_cast<std::uint8_t>(fg.valid));
-         if (!fg.valid) {
-            // We don't care about rest of the fields if the fuel gauge is not available
-            return;
+         if (fg.valid) {
+            write(it, fg.runtime_to_empty_minutes);
+            write(it, fg.runtime_to_full_minutes);
+            write(it, fg.relative_state_of_charge_percentage);
+            write(it, fg.voltage_uv);
+         } else {
+            // We don't care about rest of the fuel gauge fields if it is not available
+            std::advance(it, fuel_gauge_size);
          }
 
-         write(it, fg.runtime_to_empty_minutes);
-         write(it, fg.runtime_to_full_minutes);
-         write(it, fg.relative_state_of_charge_percentage);
-         write(it, fg.voltage_uv);
+         // Let the server know what we are currently showing, so that it can skip sending the same image again
+         write(it, hei::settings::image_server::image_fingerprint());
+
+         // Let the server pick the best encoding we can handle
+         write(it, supported_codecs);
+         write(it, supported_pixel_formats);
+         write(it, max_block_size);
+         write(it, supported_features);
+         write(it, static_cast<std::uint16_t>(CONFIG_APP_IMAGE_CLIENT_TILE_CACHE_SLOTS));
+
+         // Let the server know if the power board had to cut the power on its own
+         write(it, forced_cutoffs);
       }
 
    private:
@@ -119,24 +212,68 @@ public:
    }
 
 private:
+   static std::chrono::seconds sleep_duration() {
+      if (const auto interval_opt = hei::settings::image_server::refresh_interval(); interval_opt) {
+         return *interval_opt;
+      }
+      return std::chrono::seconds{CONFIG_APP_IMAGE_CLIENT_DEFAULT_SLEEP_DURATION_SECONDS};
+   }
+
+   //! Sleep duration after talking to the server: wake up early for a change the server knows about, but never sleep
+   //! longer than the configured interval (the server can't know about every change)
+   std::chrono::seconds next_sleep_duration() const {
+      const auto interval = sleep_duration();
+      if (session_.next_wake == 0) {
+         return interval;
+      }
+
+      const auto hint = std::chrono::seconds{
+         std::max<std::uint32_t>(session_.next_wake, CONFIG_APP_IMAGE_CLIENT_MIN_WAKE_HINT_SECONDS)};
+      if (hint >= interval) {
+         return interval;
+      }
+
+      LOG_INF("Next wake-up in %" PRIi64 " seconds (next change)", static_cast<std::int64_t>(hint.count()));
+      return hint;
+   }
+
+   //! Number of times the power board had to cut the power on its own (0 if it doesn't answer)
+   static std::uint16_t forced_cutoffs() {
+      constexpr std::chrono::milliseconds ack_timeout{CONFIG_APP_IMAGE_CLIENT_SHUTDOWN_REQUEST_DELAY_MS};
+
+      // Only a single retry: boards without the acknowledgement line never answer
+      for (int i = 0; i < 2; ++i) {
+         if (const auto res = hei::shutdown::forced_cutoffs(ack_timeout); res) {
+            if (*res != 0) {
+               LOG_WRN("Forced power cutoffs: %d", static_cast<int>(*res));
+            }
+            return *res;
+         }
+      }
+
+      return 0;
+   }
+
    static void request_shutdown(const std::chrono::seconds sleep_duration) {
+      constexpr std::chrono::milliseconds ack_timeout{CONFIG_APP_IMAGE_CLIENT_SHUTDOWN_REQUEST_DELAY_MS};
+
+      // Only repeated if the power board hasn't acknowledged the request (e.g. it has missed a byte)
       for (int i = 0; i < CONFIG_APP_IMAGE_CLIENT_NUM_SHUTDOWN_REQUESTS; ++i) {
-         hei::shutdown::request(sleep_duration);
-         k_sleep(K_MSEC(CONFIG_APP_IMAGE_CLIENT_SHUTDOWN_REQUEST_DELAY_MS));
+         if (hei::shutdown::request(sleep_duration, ack_timeout)) {
+            return;
+         }
       }
+
+      LOG_WRN("Shutdown request not acknowledged");
    }
 
    [[noreturn]] void main() {
       (void)k_event_wait(&client_events, ce_start, false, K_FOREVER);
 
-      const auto interval_opt = hei::settings::image_server::refresh_interval();
-
-      std::chrono::seconds sleep_duration{CONFIG_APP_IMAGE_CLIENT_DEFAULT_SLEEP_DURATION_SECONDS};
-      if (interval_opt) {
-         sleep_duration = *interval_opt;
-      }
-
       while (true) {
+         // Read every cycle, the settings might have been changed in the meantime
+         auto sleep_duration = image_client::sleep_duration();
+
          if (!convert_server_address()) {
             request_shutdown(sleep_duration);
             continue;
@@ -151,16 +288,14 @@ private:
             // ReSharper disable once CppDFAUnusedValue CppDFAUnreadVariable CppDeclaratorNeverUsed
             const auto delta = end - start;
             LOG_INF("Received image in %" PRIi64 " ms", delta);
+
+            // Failed fetches are retried after the regular interval instead
+            sleep_duration = next_sleep_duration();
          } else {
             LOG_ERR("Image client error: %s", res.error().message().c_str());
          }
 
-         // In any case try putting the display into the sleep mode to avoid potential issues with the driver board
-         res = shutdown_display();
-         if (!res) {
-            LOG_ERR("Display shutdown error: %s", res.error().message().c_str());
-         }
-
+         // The panel might still be updating, the connection isn't needed for that
          if (socket_) {
             if (close(socket_)) {
                LOG_ERR("Close error: %s", strerror(errno));
@@ -169,16 +304,22 @@ private:
             socket_ = 0;
          }
 
-         // Try shutting down
-         for (int i = 0; i < 10; ++i) {
-            hei::shutdown::request(sleep_duration);
-            k_sleep(K_MSEC(100));
+         // In any case try putting the display into the sleep mode to avoid potential issues with the driver board
+         res = shutdown_display();
+         if (!res) {
+            LOG_ERR("Display shutdown error: %s", res.error().message().c_str());
          }
 
-         if (const auto events =
-                k_event_wait(&client_events, ce_manual_fetch | ce_stop, true, K_SECONDS(sleep_duration.count()));
-             events & ce_stop) {
+         // Try shutting down
+         request_shutdown(sleep_duration);
+
+         const auto events =
+            k_event_wait(&client_events, ce_manual_fetch | ce_stop, true, K_SECONDS(sleep_duration.count()));
+         if (events & ce_stop) {
+            // Stay awake until started again (e.g. for a shell session)
+            hei::shutdown::keep_alive(true);
             k_event_wait(&client_events, ce_start, true, K_FOREVER);
+            hei::shutdown::keep_alive(false);
          }
       }
 
@@ -191,8 +332,7 @@ private:
    }
 
    void_t fetch_image() {
-      namespace common_t = it8951::common;
-
+      session_ = {};
       if ((socket_ = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
          return report_error("Socket creation error", errno);
       }
@@ -202,6 +342,7 @@ private:
       }
 
       LOG_INF("Connected to server");
+      reader_.reset(socket_);
 
       // Set socket to non-blocking mode
       const int flags = fcntl(socket_, F_GETFL, 0);
@@ -214,254 +355,689 @@ private:
       }
 
       // Request the new image (together with the refresh type) and send the fuel gauge readings at the same time
-      get_image_request req{};
+      get_image_request req{forced_cutoffs()};
       if (auto res = send(req.payload); !res) {
          return report_error("Error sending request", res.error().value());
       }
 
-      // Read header: message_type: u8, update_type: u8, width: u16, height: u16, num_blocks: u16
-      using response_t = std::tuple<std::uint8_t, std::uint8_t, std::uint16_t, std::uint16_t, std::uint16_t>;
-      auto response_res = read_tuple<response_t>();
-      if (!response_res) {
-         return tl::unexpected{response_res.error()};
+      // The server starts with the session parameters, and only then sends the actual response
+      auto type_res = reader_.read<std::uint8_t>();
+      if (!type_res) {
+         return tl::unexpected{type_res.error()};
+      }
+
+      auto type = static_cast<message_type>(*type_res);
+      if (type == message_type::session_response) {
+         if (auto res = receive_session(); !res) {
+            return res;
+         }
+
+         type_res = reader_.read<std::uint8_t>();
+         if (!type_res) {
+            return tl::unexpected{type_res.error()};
+         }
+         type = static_cast<message_type>(*type_res);
+      } else if (type != message_type::server_error) {
+         LOG_ERR("Missing session response: %" PRIu8, static_cast<std::uint8_t>(type));
+         return unexpected(EBADMSG);
+      }
+
+      const bool not_modified_enabled = (session_.features & feature_not_modified) != 0;
+      const bool delta_updates_enabled = (session_.features & feature_delta_updates) != 0;
+      const bool tiled_frames_enabled = (session_.features & feature_tiled_frames) != 0;
+
+      switch (type) {
+         case message_type::image_header_response:
+            return receive_full_image();
+
+         case message_type::image_delta_response:
+            if (!delta_updates_enabled) {
+               break;
+            }
+            return receive_delta_image();
+
+         case message_type::image_tiled_response:
+            if (!tiled_frames_enabled) {
+               break;
+            }
+            return receive_tiled_image();
+
+         case message_type::image_not_modified:
+            if (!not_modified_enabled) {
+               break;
+            }
+            // Nothing to do: the display is already showing the latest image
+            LOG_INF("Image not modified");
+            return {};
+
+         case message_type::server_error:
+            LOG_WRN("Server error");
+            return unexpected(EBADMSG);
+
+         default:
+            break;
+      }
+
+      LOG_ERR("Bad response: %" PRIu8, static_cast<std::uint8_t>(type));
+      return unexpected(EBADMSG);
+   }
+
+   void_t receive_session() {
+      // Read header: version: u8, payload_size: u16
+      using header_t = std::tuple<std::uint8_t, std::uint16_t>;
+      auto header_res = reader_.read_tuple<header_t>();
+      if (!header_res) {
+         return tl::unexpected{header_res.error()};
       }
 
-      const auto [type_raw, mode_raw, width_raw, image_height, num_blocks] = *response_res;
+      const auto [version, payload_size] = *header_res;
 
-      auto type = static_cast<message_type>(type_raw);
-      if (type == message_type::server_error) {
-         LOG_WRN("Server error");
+      // Read payload: codecs: u8, pixel_format: u8, block_size: u16, features: u32
+      using payload_t = std::tuple<std::uint8_t, std::uint8_t, std::uint16_t, std::uint32_t>;
+      constexpr std::size_t known_size = 1 + 1 + 2 + 4;
+      if (payload_size < known_size) {
+         LOG_ERR("Session response too short: %" PRIu16, payload_size);
          return unexpected(EBADMSG);
       }
 
-      if (type != message_type::image_header_response) {
-         LOG_ERR("Bad response: %" PRIu8, static_cast<std::uint8_t>(type));
+      auto payload_res = reader_.read_tuple<payload_t>();
+      if (!payload_res) {
+         return tl::unexpected{payload_res.error()};
+      }
+
+      // Optional: time_of_day: u32 (seconds since the local midnight), for the quiet hours of the power board
+      std::size_t read_size = known_size;
+      if (payload_size >= read_size + 4) {
+         auto time_res = reader_.read<std::uint32_t>();
+         if (!time_res) {
+            return tl::unexpected{time_res.error()};
+         }
+
+         hei::shutdown::set_time_of_day(*time_res);
+         read_size += 4;
+      }
+
+      // Optional: next_wake: u32 (seconds until the next known change, 0 - none)
+      std::uint32_t next_wake = 0;
+      if (payload_size >= read_size + 4) {
+         auto wake_res = reader_.read<std::uint32_t>();
+         if (!wake_res) {
+            return tl::unexpected{wake_res.error()};
+         }
+
+         next_wake = *wake_res;
+         read_size += 4;
+      }
+
+      // Newer servers might send more, we don't know what to do with it anyway
+      if (auto res = reader_.skip(payload_size - read_size); !res) {
+         return res;
+      }
+
+      const auto [codecs, pixel_format, block_size, features] = *payload_res;
+      LOG_DBG("Session: v=%" PRIu8 ", c=%" PRIx8 ", pf=%" PRIu8 ", bs=%" PRIu16 ", f=%" PRIx32, version, codecs,
+              pixel_format, block_size, features);
+
+      // The server should only choose from what we have offered
+      const bool valid = (codecs & ~supported_codecs) == 0 && pixel_format < 8 &&
+                         (supported_pixel_formats & BIT(pixel_format)) != 0 && block_size != 0 &&
+                         block_size <= max_block_size && (features & ~supported_features) == 0;
+      if (!valid) {
+         LOG_ERR("Bad session parameters");
          return unexpected(EBADMSG);
       }
 
-      const auto mode = static_cast<common_t::waveform_mode>(mode_raw);
+      session_ = {.codecs = codecs,
+                  .pixel_format = static_cast<it8951::common::pixel_format>(pixel_format),
+                  .block_size = block_size,
+                  .features = features,
+                  .next_wake = next_wake};
+      return {};
+   }
+
+   static expected<it8951::common::waveform_mode> parse_mode(std::uint8_t mode_raw) {
+      const auto mode = static_cast<it8951::common::waveform_mode>(mode_raw);
       switch (mode) {
          case it8951::common::waveform_mode::init:
          case it8951::common::waveform_mode::direct_update:
          case it8951::common::waveform_mode::grayscale_clearing:
          case it8951::common::waveform_mode::grayscale_limited:
          case it8951::common::waveform_mode::grayscale_limited_reduced:
-            break;
+            return mode;
 
          default:
             LOG_ERR("Bad wave form mode: %d", static_cast<int>(mode));
             return unexpected(EBADMSG);
       }
+   }
+
+   it8951::common::image::config image_config(it8951::common::waveform_mode mode) const {
+      namespace common_t = it8951::common;
+      return {.endianness = common_t::endianness::little,
+              .pixel_format = session_.pixel_format,
+              .rotation = common_t::rotation::rotate0,
+              .mode = mode};
+   }
+
+   //! Number of pixels in a byte of the packed pixel data
+   static std::uint16_t pixels_per_byte(it8951::common::pixel_format format) {
+      switch (format) {
+         case it8951::common::pixel_format::pf2bpp:
+            return 4;
 
-      // x2 because the transmitted image is 4 bytes per pixel
-      const auto image_width = static_cast<std::uint16_t>(width_raw * 2);
+         case it8951::common::pixel_format::pf3bpp:
+         case it8951::common::pixel_format::pf4bpp:
+            // 3bpp pixels are padded to 4 bits
+            return 2;
+
+         case it8951::common::pixel_format::pf8bpp:
+         default:
+            return 1;
+      }
+   }
+
+   static void store_fingerprint(std::uint32_t fingerprint) {
+      if (!hei::settings::image_server::set_image_fingerprint(fingerprint)) {
+         // Not fatal, we will just receive the same image once again
+         LOG_WRN("Error storing image fingerprint");
+      }
+   }
+
+   void_t receive_full_image() {
+      // Read header: update_type: u8, width: u16, height: u16, num_blocks: u16, fingerprint: u32
+      using response_t = std::tuple<std::uint8_t, std::uint16_t, std::uint16_t, std::uint16_t, std::uint32_t>;
+      auto response_res = reader_.read_tuple<response_t>();
+      if (!response_res) {
+         return tl::unexpected{response_res.error()};
+      }
+
+      const auto [mode_raw, width_raw, image_height, num_blocks, fingerprint] = *response_res;
+
+      const auto mode_res = parse_mode(mode_raw);
+      if (!mode_res) {
+         return tl::unexpected{mode_res.error()};
+      }
+
+      // The width is transmitted in bytes
+      const auto image_width = static_cast<std::uint16_t>(width_raw * pixels_per_byte(session_.pixel_format));
 
       LOG_DBG("Image Header: w=%" PRIu16 ", h=%" PRIu16 ", n=%" PRIu16, image_width, image_height, num_blocks);
 
       auto &display = hei::display::get();
-      auto dr = display.begin({.x = 0, .y = 0, .width = image_width, .height = image_height},
-                              {.endianness = common_t::endianness::little,
-                               .pixel_format = common_t::pixel_format::pf4bpp,
-                               .rotation = common_t::rotation::rotate0,
-                               .mode = mode});
+      auto dr = display.begin({.x = 0, .y = 0, .width = image_width, .height = image_height}, image_config(*mode_res));
       if (!dr) {
          return dr;
       }
 
-      for (std::uint16_t block = 0; block < num_blocks; ++block) {
-         using block_t = std::tuple<std::uint8_t, std::uint16_t, std::uint16_t>;
-         auto block_res = read_tuple<block_t>();
-         if (!block_res) {
-            return tl::unexpected{response_res.error()};
-         }
+      dr = transfer_blocks(num_blocks);
+      if (!dr) {
+         return dr;
+      }
 
-         const auto [block_type_raw, uncompressed_size, compressed_size] = *block_res;
-         type = static_cast<message_type>(block_type_raw);
-         if (type == message_type::server_error) {
-            LOG_WRN("Server error");
-            return unexpected(EBADMSG);
+      dr = display.end();
+      if (!dr) {
+         return dr;
+      }
+
+      store_fingerprint(fingerprint);
+      return {};
+   }
+
+   void_t receive_delta_image() {
+      // Read header: update_type: u8, num_areas: u16, fingerprint: u32
+      using response_t = std::tuple<std::uint8_t, std::uint16_t, std::uint32_t>;
+      auto response_res = reader_.read_tuple<response_t>();
+      if (!response_res) {
+         return tl::unexpected{response_res.error()};
+      }
+
+      const auto [mode_raw, num_areas, fingerprint] = *response_res;
+
+      const auto mode_res = parse_mode(mode_raw);
+      if (!mode_res) {
+         return tl::unexpected{mode_res.error()};
+      }
+
+      if (num_areas == 0 || num_areas > delta_areas_.size()) {
+         LOG_ERR("Bad number of delta areas: %" PRIu16, num_areas);
+         return unexpected(EMSGSIZE);
+      }
+
+      LOG_DBG("Delta Header: n=%" PRIu16, num_areas);
+
+      auto &display = hei::display::get();
+      auto dr = display.prepare();
+      if (!dr) {
+         return dr;
+      }
+
+      for (std::uint16_t i = 0; i < num_areas; ++i) {
+         // Read area header: message_type: u8, x: u16, y: u16, width: u16, height: u16, num_blocks: u16
+         using area_t = std::tuple<std::uint8_t, std::uint16_t, std::uint16_t, std::uint16_t, std::uint16_t,
+                                   std::uint16_t>;
+         auto area_res = reader_.read_tuple<area_t>();
+         if (!area_res) {
+            return tl::unexpected{area_res.error()};
          }
 
-         if (type != message_type::image_block_response) {
-            LOG_ERR("Bad block type: %" PRIu8, static_cast<std::uint8_t>(type));
+         const auto [area_type_raw, x, y, width, height, num_blocks] = *area_res;
+         if (static_cast<message_type>(area_type_raw) != message_type::image_area_response) {
+            LOG_ERR("Bad area type: %" PRIu8, area_type_raw);
             return unexpected(EBADMSG);
          }
 
-         if (auto ec = receive(compressed_size); !ec) {
-            return report_error("Error receiving block", ec.error().value());
-         }
+         LOG_DBG("Delta Area: x=%" PRIu16 ", y=%" PRIu16 ", w=%" PRIu16 ", h=%" PRIu16 ", n=%" PRIu16, x, y, width,
+                 height, num_blocks);
 
-         const auto res = LZ4_decompress_safe(reinterpret_cast<const char *>(recv_buffer_.data()),
-                                              reinterpret_cast<char *>(image_buffer_.data()), compressed_size,
-                                              static_cast<int>(image_buffer_.size()));
-         if (res < 0) {
-            LOG_ERR("Image block decompression error: %d", res);
-            return unexpected(res);
+         auto &area = delta_areas_[i];
+         area = {.x = x, .y = y, .width = width, .height = height};
+
+         dr = display.begin_area(area, image_config(*mode_res));
+         if (!dr) {
+            return dr;
          }
 
-         if (res != uncompressed_size) {
-            LOG_ERR("Decompressed data size mismatch: %d vs %d", res, static_cast<int>(uncompressed_size));
-            return unexpected(EBADMSG);
+         dr = transfer_blocks(num_blocks);
+         if (!dr) {
+            return dr;
          }
 
-         dr = display.update({image_buffer_.data(), uncompressed_size});
+         dr = display.end_area();
          if (!dr) {
             return dr;
          }
       }
 
-      return display.end();
+      dr = display.refresh({delta_areas_.data(), num_areas}, *mode_res);
+      if (!dr) {
+         return dr;
+      }
+
+      store_fingerprint(fingerprint);
+      return {};
    }
 
-   static void_t shutdown_display() {
+   void_t receive_tiled_image() {
+      // Read header: update_type: u8, width: u16, height: u16, tile_width: u8, tile_height: u8, fingerprint: u32
+      // The width is in bytes, the tile size is in pixels
+      using response_t =
+         std::tuple<std::uint8_t, std::uint16_t, std::uint16_t, std::uint8_t, std::uint8_t, std::uint32_t>;
+      auto response_res = reader_.read_tuple<response_t>();
+      if (!response_res) {
+         return tl::unexpected{response_res.error()};
+      }
+
+      const auto [mode_raw, width_raw, image_height, tile_w, tile_h, fingerprint] = *response_res;
+
+      const auto mode_res = parse_mode(mode_raw);
+      if (!mode_res) {
+         return tl::unexpected{mode_res.error()};
+      }
+
+      if (tile_w != tile_width || tile_h != tile_height ||
+          session_.pixel_format != it8951::common::pixel_format::pf4bpp) {
+         LOG_ERR("Bad tile format: %" PRIu8 "x%" PRIu8, tile_w, tile_h);
+         return unexpected(EBADMSG);
+      }
+
+      // Every line is composed in a single transmit buffer
+      const std::size_t columns = (width_raw + tile_row_bytes - 1) / tile_row_bytes;
+      if (columns > tile_map_.size() || width_raw > CONFIG_EPD_TX_BUFFER_SIZE) {
+         LOG_ERR("Bad tiled image width: %" PRIu16, width_raw);
+         return unexpected(EMSGSIZE);
+      }
+
+      const auto image_width = static_cast<std::uint16_t>(width_raw * pixels_per_byte(session_.pixel_format));
+
+      LOG_DBG("Tiled Header: w=%" PRIu16 ", h=%" PRIu16, image_width, image_height);
+
       auto &display = hei::display::get();
-      return display.shutdown();
-   }
+      auto dr = display.begin({.x = 0, .y = 0, .width = image_width, .height = image_height}, image_config(*mode_res));
+      if (!dr) {
+         return dr;
+      }
 
-   bool convert_server_address() {
-      const auto port_opt = hei::settings::image_server::port();
-      if (!port_opt) {
-         LOG_ERR("Missing server port");
-         return false;
+      if (auto res = hei::image_pipeline::begin(); !res) {
+         return res;
       }
 
-      const auto address_opt = hei::settings::image_server::address();
-      if (!address_opt) {
-         LOG_ERR("Missing server address");
-         return false;
+      auto rr = receive_tile_bands(width_raw, image_height);
+      auto pr = hei::image_pipeline::end();
+      if (!rr) {
+         return rr;
       }
 
-      server_address_.sin_family = AF_INET;
-      server_address_.sin_port = htons(*port_opt);
+      if (!pr) {
+         return pr;
+      }
 
-      // TODO: DNS support
-      if (inet_pton(AF_INET, address_opt->data(), &server_address_.sin_addr) <= 0) {
-         LOG_ERR("Unsupported address: %s", address_opt->data());
-         return false;
+      dr = display.end();
+      if (!dr) {
+         return dr;
       }
 
-      return true;
+      store_fingerprint(fingerprint);
+      return {};
    }
 
-   template <typename Tuple, std::size_t I>
-   bool read_tuple_element(Tuple &t, std::error_code &ec) {
-      using element_t = std::tuple_element_t<I, Tuple>;
-      if (auto res = read<element_t>()) {
-         std::get<I>(t) = res.value();
-         return true;
-      } else {
-         ec = res.error();
-         return false;
+   void_t receive_tile_bands(std::uint16_t line_bytes, std::uint16_t height) {
+      const std::size_t columns = (line_bytes + tile_row_bytes - 1) / tile_row_bytes;
+      for (std::uint16_t y = 0; y < height; y += tile_height) {
+         const auto rows = std::min<std::uint16_t>(tile_height, height - y);
+         auto res = receive_tile_band(columns).and_then([&] {
+            return compose_tile_band(columns, line_bytes, rows);
+         });
+
+         if (!res) {
+            return res;
+         }
       }
+
+      return {};
    }
 
-   template <typename Tuple, std::size_t... I>
-   void_t read_tuple_impl(Tuple &t, std::index_sequence<I...>) {
-      std::error_code ec;
-      if (const bool success = (read_tuple_element<Tuple, I>(t, ec) && ...); !success) {
-         return tl::unexpected{ec};
+   void_t receive_tile_band(std::size_t columns) {
+      // Read header: message_type: u8, num_new_tiles: u16, num_blocks: u16
+      // Followed by num_new_tiles slot indices, num_blocks blocks with the new tiles and the slot index for every column
+      using band_t = std::tuple<std::uint8_t, std::uint16_t, std::uint16_t>;
+      auto band_res = reader_.read_tuple<band_t>();
+      if (!band_res) {
+         return tl::unexpected{band_res.error()};
       }
+
+      const auto [band_type_raw, num_new_tiles, num_blocks] = *band_res;
+      if (static_cast<message_type>(band_type_raw) != message_type::tile_band_response) {
+         LOG_ERR("Bad band type: %" PRIu8, band_type_raw);
+         return unexpected(EBADMSG);
+      }
+
+      if (num_new_tiles > new_tiles_.size()) {
+         LOG_ERR("Too many new tiles: %" PRIu16, num_new_tiles);
+         return unexpected(EMSGSIZE);
+      }
+
+      if (auto res = reader_.read({new_tiles_.data(), num_new_tiles}); !res) {
+         return res;
+      }
+
+      // Both the new tiles and the tile map index the tile cache
+      const auto bad_slot = [](std::uint8_t slot) {
+         return slot >= CONFIG_APP_IMAGE_CLIENT_TILE_CACHE_SLOTS;
+      };
+      if (std::any_of(new_tiles_.begin(), new_tiles_.begin() + num_new_tiles, bad_slot)) {
+         LOG_ERR("Bad new tile slots");
+         return unexpected(EBADMSG);
+      }
+
+      std::size_t next_tile = 0;
+      for (std::uint16_t block = 0; block < num_blocks; ++block) {
+         if (auto res = receive_tile_block(next_tile, num_new_tiles); !res) {
+            return res;
+         }
+      }
+
+      if (next_tile != num_new_tiles) {
+         LOG_ERR("Missing tile data: %zu / %" PRIu16, next_tile, num_new_tiles);
+         return unexpected(EBADMSG);
+      }
+
+      if (auto res = reader_.read({tile_map_.data(), columns}); !res) {
+         return res;
+      }
+
+      if (std::any_of(tile_map_.begin(), tile_map_.begin() + columns, bad_slot)) {
+         LOG_ERR("Bad tile map");
+         return unexpected(EBADMSG);
+      }
+
       return {};
    }
 
-   template <typename Tuple>
-   expected<Tuple> read_tuple() {
-      Tuple res;
-      const auto op_res = read_tuple_impl(res, std::make_index_sequence<std::tuple_size_v<Tuple>>{});
-      if (!op_res) {
-         return tl::unexpected{op_res.error()};
+   void_t receive_tile_block(std::size_t &next_tile, std::size_t num_new_tiles) {
+      using block_t = std::tuple<std::uint8_t, std::uint16_t, std::uint16_t>;
+      auto block_res = reader_.read_tuple<block_t>();
+      if (!block_res) {
+         return tl::unexpected{block_res.error()};
+      }
+
+      const auto [block_type_raw, uncompressed_size, compressed_size] = *block_res;
+      if (static_cast<message_type>(block_type_raw) != message_type::image_block_response) {
+         LOG_ERR("Bad tile block type: %" PRIu8, block_type_raw);
+         return unexpected(EBADMSG);
+      }
+
+      // Blocks only contain whole tiles
+      if ((uncompressed_size % tile_bytes) != 0 || next_tile + uncompressed_size / tile_bytes > num_new_tiles) {
+         LOG_ERR("Bad tile block size: %" PRIu16, uncompressed_size);
+         return unexpected(EBADMSG);
+      }
+
+      // Borrow a pipeline block for the decompression, it is returned right away
+      auto acquire_res = hei::image_pipeline::acquire();
+      if (!acquire_res) {
+         return tl::unexpected{acquire_res.error()};
       }
+
+      auto &b = **acquire_res;
+      auto res = load_tiles(b, compressed_size, uncompressed_size, next_tile);
+      hei::image_pipeline::release(b);
       return res;
    }
 
-   template <std::unsigned_integral T>
-   expected<T> read() {
-      constexpr auto size = sizeof(T);
-      if (auto ec = receive(size); !ec) {
-         return tl::unexpected(ec.error());
+   void_t load_tiles(hei::image_pipeline::block &b,
+                     std::uint16_t compressed_size,
+                     std::uint16_t uncompressed_size,
+                     std::size_t &next_tile) {
+      if (compressed_size > b.compressed.size() || uncompressed_size > b.pixels.size()) {
+         LOG_ERR("Tile block too big: %" PRIu16 " / %" PRIu16, compressed_size, uncompressed_size);
+         return unexpected(EMSGSIZE);
       }
 
-      if (size == 1) {
-         // Only one byte - just return it after casting
-         return static_cast<T>(recv_buffer_[0]);
+      if (auto ec = reader_.read({b.compressed.data(), compressed_size}); !ec) {
+         return report_error("Error receiving tile block", ec.error().value());
       }
 
-      // Decode as little-endian
-      T result{};
-      for (std::size_t i = 0; i < size; ++i) {
-         if (i == 0) {
-            result |= recv_buffer_[i];
-            continue;
-         }
+      const auto res = LZ4_decompress_safe(reinterpret_cast<const char *>(b.compressed.data()),
+                                           reinterpret_cast<char *>(b.pixels.data()), compressed_size,
+                                           static_cast<int>(b.pixels.size()));
+      if (res != uncompressed_size) {
+         LOG_ERR("Tile block decompression error: %d", res);
+         return unexpected(EBADMSG);
+      }
 
-         const T tmp = static_cast<T>(static_cast<T>(recv_buffer_[i]) << (i * 8));
-         result |= tmp;
+      for (std::size_t offset = 0; offset < uncompressed_size; offset += tile_bytes) {
+         auto &tile = tiles_[new_tiles_[next_tile++]];
+         std::memcpy(tile.data(), b.pixels.data() + offset, tile.size());
       }
 
-      return result;
+      return {};
    }
 
-   [[nodiscard]] void_t receive(std::size_t num_bytes) {
-      fd_set read_fds{}, err_fds{};
-      timeval tv{};
-
+   //! Build the lines of a band from the cached tiles, and pass them to the pipeline for writing
+   void_t compose_tile_band(std::size_t columns, std::size_t line_bytes, std::uint16_t rows) {
+      hei::image_pipeline::block *b = nullptr;
       std::size_t offset = 0;
-      while (true) {
-         if (offset == num_bytes) {
-            // Done reading requested number of bytes
-            return {};
+
+      const auto submit = [&] {
+         b->type = hei::image_pipeline::encoding::raw;
+         b->uncompressed_size = static_cast<std::uint16_t>(offset);
+         hei::image_pipeline::submit(*b);
+         b = nullptr;
+      };
+
+      for (std::uint16_t row = 0; row < rows; ++row) {
+         if (b && offset + line_bytes > b->pixels.size()) {
+            submit();
          }
 
-         FD_ZERO(&read_fds);
-         FD_ZERO(&err_fds);
-         FD_SET(socket_, &read_fds);
-         FD_SET(socket_, &err_fds);
+         if (!b) {
+            auto acquire_res = hei::image_pipeline::acquire();
+            if (!acquire_res) {
+               return tl::unexpected{acquire_res.error()};
+            }
 
-         tv.tv_sec = CONFIG_APP_IMAGE_CLIENT_READ_TIMEOUT_SEC;
-         tv.tv_usec = 0;
+            b = *acquire_res;
+            offset = 0;
+         }
 
-         const int activity = select(socket_ + 1, &read_fds, nullptr, &err_fds, &tv);
-         if (activity < 0) {
-            return report_error("Read select error", errno);
+         auto line = b->pixels.data() + offset;
+         for (std::size_t column = 0; column < columns; ++column) {
+            // The last column might be cut off
+            const auto start = column * tile_row_bytes;
+            const auto count = std::min(tile_row_bytes, line_bytes - start);
+            std::memcpy(line + start, tiles_[tile_map_[column]].data() + row * tile_row_bytes, count);
          }
 
-         if (activity == 0) {
-            LOG_ERR("Receive timeout");
-            return unexpected(ETIMEDOUT);
+         offset += line_bytes;
+      }
+
+      if (b) {
+         submit();
+      }
+
+      return {};
+   }
+
+   void_t transfer_blocks(std::uint16_t num_blocks) {
+      // Receive the blocks here, the pipeline threads take care of decompression and display updates
+      if (auto res = hei::image_pipeline::begin(); !res) {
+         return res;
+      }
+
+      auto rr = receive_blocks(num_blocks);
+      auto pr = hei::image_pipeline::end();
+      if (!rr) {
+         return rr;
+      }
+
+      return pr;
+   }
+
+   void_t receive_blocks(std::uint16_t num_blocks) {
+      for (std::uint16_t block = 0; block < num_blocks; ++block) {
+         using block_t = std::tuple<std::uint8_t, std::uint16_t, std::uint16_t>;
+         auto block_res = reader_.read_tuple<block_t>();
+         if (!block_res) {
+            return tl::unexpected{block_res.error()};
          }
 
-         if (FD_ISSET(socket_, &err_fds)) {
-            int error = 0;
-            socklen_t len = sizeof(error);
-            if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
-               LOG_ERR("Unknown read socket error");
-               return unexpected(EIO);
-            } else if (error != 0) {
-               return report_error("Read socket error", error);
-            }
-            return unexpected(EIO);
+         // The last field is the fill word for the fill blocks
+         const auto [block_type_raw, uncompressed_size, compressed_size] = *block_res;
+         const auto type = static_cast<message_type>(block_type_raw);
+         if (type == message_type::server_error) {
+            LOG_WRN("Server error");
+            return unexpected(EBADMSG);
          }
 
-         if (!FD_ISSET(socket_, &read_fds)) {
-            continue;
+         const auto encoding_res = parse_block_type(type);
+         if (!encoding_res) {
+            return tl::unexpected{encoding_res.error()};
          }
 
-         const ssize_t num_received = ::read(socket_, recv_buffer_.data() + offset, num_bytes - offset);
-         if (num_received == 0) {
-            LOG_ERR("Read connection closed");
-            return unexpected(ECONNRESET);
+         auto acquire_res = hei::image_pipeline::acquire();
+         if (!acquire_res) {
+            // One of the downstream stages has failed, no point in receiving the rest of the image
+            return tl::unexpected{acquire_res.error()};
          }
 
-         if (num_received > 0) {
-            offset += num_received;
+         auto &b = **acquire_res;
+         b.type = *encoding_res;
+
+         if (b.type == hei::image_pipeline::encoding::fill) {
+            // Nothing to receive: the display driver repeats the word on its own, so the size is not limited by
+            // the block buffers. Data is transferred in words, though.
+            if ((uncompressed_size % 2) != 0) {
+               LOG_ERR("Bad fill size: %" PRIu16, uncompressed_size);
+               hei::image_pipeline::release(b);
+               return unexpected(EBADMSG);
+            }
+
+            b.fill_word = compressed_size;
+            b.uncompressed_size = uncompressed_size;
+            hei::image_pipeline::submit(b);
             continue;
          }
 
-         // ReSharper disable once CppIdenticalOperandsInBinaryExpression CppDFAConstantConditions
-         if (const int error = errno; error != EWOULDBLOCK && error != EAGAIN) {
-            return report_error("Read error", error);
+         if (compressed_size > b.compressed.size() || uncompressed_size > b.pixels.size() ||
+             uncompressed_size > session_.block_size) {
+            LOG_ERR("Block too big: %" PRIu16 " / %" PRIu16, compressed_size, uncompressed_size);
+            hei::image_pipeline::release(b);
+            return unexpected(EMSGSIZE);
          }
+
+         if (auto ec = reader_.read({b.compressed.data(), compressed_size}); !ec) {
+            hei::image_pipeline::release(b);
+            return report_error("Error receiving block", ec.error().value());
+         }
+
+         b.compressed_size = compressed_size;
+         b.uncompressed_size = uncompressed_size;
+         hei::image_pipeline::submit(b);
       }
+
+      return {};
+   }
+
+   expected<hei::image_pipeline::encoding> parse_block_type(message_type type) const {
+      using hei::image_pipeline::encoding;
+      switch (type) {
+         case message_type::image_block_response:
+            return encoding::lz4;
+
+         case message_type::image_linked_block_response:
+            if ((session_.codecs & codec_linked_blocks) == 0) {
+               break;
+            }
+            return encoding::lz4_linked;
+
+         case message_type::image_fill_block_response:
+            if ((session_.codecs & codec_fill_blocks) == 0) {
+               break;
+            }
+            return encoding::fill;
+
+         default:
+            break;
+      }
+
+      LOG_ERR("Bad block type: %" PRIu8, static_cast<std::uint8_t>(type));
+      return unexpected(EBADMSG);
+   }
+
+   static void_t shutdown_display() {
+      auto &display = hei::display::get();
+
+      // Cutting the power in the middle of an update would leave the panel half-drawn
+      if (auto res = display.wait_for_refresh(); !res) {
+         LOG_WRN("Display refresh wait error: %s", res.error().message().c_str());
+      }
+
+      return display.shutdown();
+   }
+
+   bool convert_server_address() {
+      const auto port_opt = hei::settings::image_server::port();
+      if (!port_opt) {
+         LOG_ERR("Missing server port");
+         return false;
+      }
+
+      const auto address_opt = hei::settings::image_server::address();
+      if (!address_opt) {
+         LOG_ERR("Missing server address");
+         return false;
+      }
+
+      server_address_.sin_family = AF_INET;
+      server_address_.sin_port = htons(*port_opt);
+
+      // TODO: DNS support
+      if (inet_pton(AF_INET, address_opt->data(), &server_address_.sin_addr) <= 0) {
+         LOG_ERR("Unsupported address: %s", address_opt->data());
+         return false;
+      }
+
+      return true;
    }
 
    [[nodiscard]] void_t send(const std::span<const std::uint8_t> payload) const {
@@ -530,8 +1106,14 @@ private:
 private:
    sockaddr_in server_address_{};
    int socket_{};
-   std::array<std::uint8_t, CONFIG_APP_IMAGE_CLIENT_RECV_BUFFER_SIZE> recv_buffer_{};
-   std::array<std::uint8_t, CONFIG_APP_IMAGE_CLIENT_IMAGE_BUFFER_SIZE> image_buffer_{};
+   session session_{};
+   hei::socket_reader reader_{std::chrono::seconds{CONFIG_APP_IMAGE_CLIENT_READ_TIMEOUT_SEC}};
+   std::array<it8951::common::image::area, CONFIG_APP_IMAGE_CLIENT_MAX_DELTA_AREAS> delta_areas_{};
+
+   // Tiled frames: tile cache, slots of the new tiles in the current band, and a slot for every column of the band
+   std::array<tile_t, CONFIG_APP_IMAGE_CLIENT_TILE_CACHE_SLOTS> tiles_{};
+   std::array<std::uint8_t, CONFIG_APP_IMAGE_CLIENT_TILE_CACHE_SLOTS> new_tiles_{};
+   std::array<std::uint8_t, CONFIG_APP_IMAGE_CLIENT_TILE_MAX_COLUMNS> tile_map_{};
 };
 
 image_client client{};
@@ -0,0 +1,257 @@
+/**
+ * @file   image_pipeline.cpp
+ * @author Dennis Sitelew
+ * @date   Oct. 16, 2026
+ */
+
+#include <hei/display.hpp>
+#include <hei/image_pipeline.hpp>
+
+#include <zephyr-cpp/error.hpp>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <lz4.h>
+
+#include <atomic>
+
+#include <autoconf.h>
+
+LOG_MODULE_REGISTER(image_pipeline, CONFIG_APP_LOG_LEVEL);
+
+using namespace zephyr;
+using namespace hei::image_pipeline;
+
+namespace {
+
+static_assert(CONFIG_APP_IMAGE_PIPELINE_DEPTH >= 2, "At least two blocks are required for the stages to overlap");
+static_assert(CONFIG_APP_IMAGE_PIPELINE_DEPTH <= CONFIG_EPD_TX_BUFFER_COUNT,
+              "Every image block needs a display driver transmit buffer");
+
+std::array<block, CONFIG_APP_IMAGE_PIPELINE_DEPTH> blocks{};
+
+// The queues carry block pointers, a nullptr marks the end of a transfer.
+// Decoder and writer queues have one extra slot for the end marker.
+K_MSGQ_DEFINE(free_queue, sizeof(block *), CONFIG_APP_IMAGE_PIPELINE_DEPTH, alignof(block *));
+K_MSGQ_DEFINE(decoder_queue, sizeof(block *), CONFIG_APP_IMAGE_PIPELINE_DEPTH + 1, alignof(block *));
+K_MSGQ_DEFINE(writer_queue, sizeof(block *), CONFIG_APP_IMAGE_PIPELINE_DEPTH + 1, alignof(block *));
+
+//! Signalled by the writer once the end marker has passed through all the stages
+K_SEM_DEFINE(transfer_done, 0, 1);
+
+//! First error encountered by any of the stages (0 - no error)
+std::atomic_int failure{0};
+
+void fail(const std::error_code &ec) {
+   int expected = 0;
+   failure.compare_exchange_strong(expected, ec.value() != 0 ? ec.value() : EIO);
+}
+
+bool failed() {
+   return failure.load() != 0;
+}
+
+void put(k_msgq &queue, block *b) {
+   // All the queues are big enough to hold every block plus the end marker, so this should never block
+   (void)k_msgq_put(&queue, &b, K_FOREVER);
+}
+
+block *get(k_msgq &queue) {
+   block *b = nullptr;
+   (void)k_msgq_get(&queue, &b, K_FOREVER);
+   return b;
+}
+
+void_t decode(block &b, const block *previous) {
+   const auto src = reinterpret_cast<const char *>(b.compressed.data());
+   const auto dst = reinterpret_cast<char *>(b.pixels.data());
+   const auto capacity = static_cast<int>(b.pixels.size());
+
+   int res;
+   if (b.type == encoding::lz4_linked) {
+      // The previous block is still intact: the decoder is the only one writing pixels, and the blocks are used in
+      // a round-robin fashion, so it won't be reused before the current block is done.
+      if (!previous || previous == &b) {
+         LOG_ERR("Linked image block without a dictionary");
+         return unexpected(EBADMSG);
+      }
+
+      res = LZ4_decompress_safe_usingDict(src, dst, b.compressed_size, capacity,
+                                          reinterpret_cast<const char *>(previous->pixels.data()),
+                                          previous->uncompressed_size);
+   } else {
+      res = LZ4_decompress_safe(src, dst, b.compressed_size, capacity);
+   }
+
+   if (res < 0) {
+      LOG_ERR("Image block decompression error: %d", res);
+      return unexpected(res);
+   }
+
+   if (res != b.uncompressed_size) {
+      LOG_ERR("Decompressed data size mismatch: %d vs %d", res, static_cast<int>(b.uncompressed_size));
+      return unexpected(EBADMSG);
+   }
+
+   return {};
+}
+
+[[noreturn]] void decoder_fn(void *p1, void *p2, void *p3) {
+   ARG_UNUSED(p1);
+   ARG_UNUSED(p2);
+   ARG_UNUSED(p3);
+
+   // Dictionary for the linked blocks, only valid within a single transfer
+   const block *previous = nullptr;
+
+   while (true) {
+      auto b = get(decoder_queue);
+
+      const bool compressed = b && (b->type == encoding::lz4 || b->type == encoding::lz4_linked);
+
+      // Keep passing the blocks along after a failure, the writer is responsible for returning them
+      if (compressed && !failed()) {
+         decode(*b, previous).or_else(fail);
+      }
+
+      // Only the LZ4 blocks can be used as the dictionary
+      previous = compressed ? b : nullptr;
+      put(writer_queue, b);
+   }
+}
+
+//! Called by the display driver once a submitted block is written
+void on_written(const void_t &result, void *user_data) {
+   result.or_else(fail);
+   put(free_queue, static_cast<block *>(user_data));
+}
+
+[[noreturn]] void writer_fn(void *p1, void *p2, void *p3) {
+   ARG_UNUSED(p1);
+   ARG_UNUSED(p2);
+   ARG_UNUSED(p3);
+
+   auto &display = hei::display::get();
+
+   while (true) {
+      auto b = get(writer_queue);
+      if (!b) {
+         display.flush().or_else(fail);
+         k_sem_give(&transfer_done);
+         continue;
+      }
+
+      if (failed()) {
+         put(free_queue, b);
+         continue;
+      }
+
+      if (b->type == encoding::fill) {
+         display.fill(b->fill_word, b->uncompressed_size).or_else(fail);
+         put(free_queue, b);
+         continue;
+      }
+
+      // The driver returns the block once the data is sent, so we can move on to the next one right away
+      display.submit({b->pixels.data(), b->uncompressed_size}, on_written, b).or_else([&](const auto &ec) {
+         fail(ec);
+         put(free_queue, b);
+      });
+   }
+}
+
+//! Give the transmit buffers back to the display driver, e.g. for the fills or the calibration
+void free_buffers() {
+   k_msgq_purge(&free_queue);
+
+   auto &display = hei::display::get();
+   for (auto &b : blocks) {
+      if (!b.pixels.empty()) {
+         display.free_buffer(b.pixels);
+         b.pixels = {};
+      }
+   }
+}
+
+// ReSharper disable CppDeclaratorNeverUsed
+// NOLINTBEGIN(*-branch-clone, *-misplaced-const)
+K_THREAD_DEFINE(image_decoder_thread_id,
+                CONFIG_APP_IMAGE_PIPELINE_DECODER_STACK_SIZE,
+                decoder_fn,
+                nullptr,
+                nullptr,
+                nullptr,
+                CONFIG_APP_IMAGE_PIPELINE_THREAD_PRIORITY,
+                0,
+                0);
+
+K_THREAD_DEFINE(image_writer_thread_id,
+                CONFIG_APP_IMAGE_PIPELINE_WRITER_STACK_SIZE,
+                writer_fn,
+                nullptr,
+                nullptr,
+                nullptr,
+                CONFIG_APP_IMAGE_PIPELINE_THREAD_PRIORITY,
+                0,
+                0);
+// NOLINTEND(*-branch-clone, *-misplaced-const)
+// ReSharper restore CppDeclaratorNeverUsed
+
+} // namespace
+
+namespace hei::image_pipeline {
+
+void_t begin() {
+   // The previous transfer has been drained by end(), so all the blocks are either in the free queue or nowhere
+   k_msgq_purge(&free_queue);
+   k_sem_reset(&transfer_done);
+   failure = 0;
+
+   // The transmit buffers are only held for the duration of a transfer, and returned by end()
+   auto &display = hei::display::get();
+   for (auto &b : blocks) {
+      auto res = display.allocate_buffer();
+      if (!res) {
+         free_buffers();
+         return tl::unexpected{res.error()};
+      }
+
+      b.pixels = *res;
+      put(free_queue, &b);
+   }
+
+   return {};
+}
+
+expected<block *> acquire() {
+   auto b = get(free_queue);
+   if (const auto error = failure.load()) {
+      put(free_queue, b);
+      return unexpected(error);
+   }
+   return b;
+}
+
+void submit(block &b) {
+   put(decoder_queue, &b);
+}
+
+void release(block &b) {
+   put(free_queue, &b);
+}
+
+void_t end() {
+   put(decoder_queue, nullptr);
+   (void)k_sem_take(&transfer_done, K_FOREVER);
+
+   // The writer has flushed the display, so none of the blocks is in use anymore
+   free_buffers();
+
+   if (const auto error = failure.load()) {
+      return unexpected(error);
+   }
+   return {};
+}
+
+} // namespace hei::image_pipeline
@@ -11,6 +11,7 @@
 #include <hei/http/server.hpp>
 #include <hei/image_client.hpp>
 #include <hei/led.hpp>
+#include <hei/shutdown.hpp>
 #include <hei/wifi.hpp>
 
 LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
@@ -45,6 +46,11 @@ int main() {
 
    setup_connectivity();
 
+   // Nothing is going to ask the power board for a shutdown while we are being configured
+   if (hei::wifi::is_hosting()) {
+      hei::shutdown::keep_alive(true);
+   }
+
    hei::http::server::start();
    if (!hei::wifi::is_hosting()) {
       hei::image_client::start();
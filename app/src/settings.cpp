@@ -14,6 +14,7 @@
 #include <array>
 #include <cstring>
 #include <string_view>
+#include <type_traits>
 #include <valarray>
 
 #if CONFIG_SHELL
@@ -71,10 +72,12 @@ public:
 
 public:
    int load(std::size_t len, settings_read_cb read_cb, void *cb_arg) override {
-      if (len != sizeof(T)) {
+      // Unsigned values saved with a narrower type (e.g. by an older firmware) are widened (little-endian)
+      if (len > sizeof(T) || (len != sizeof(T) && std::is_signed_v<T>)) {
          return -EINVAL;
       }
 
+      value_ = {};
       auto rc = read_cb(cb_arg, &value_, len);
       if (rc >= 0) {
          is_loaded_ = true;
@@ -270,6 +273,67 @@ public:
 
 using loadable_default_string_t = loadable_default_string<>;
 
+////////////////////////////////////////////////////////////////////////////////
+/// Class: loadable_default_struct
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+   requires std::is_trivially_copyable_v<T>
+class loadable_default_struct : public loadable {
+public:
+   loadable_default_struct(const char *key, const char *path, const T &default_value)
+      : loadable(key, path)
+      , value_{default_value} {
+      is_loaded_ = true;
+   }
+
+public:
+   int load(std::size_t len, settings_read_cb read_cb, void *cb_arg) override {
+      if (len != sizeof(T)) {
+         return -EINVAL;
+      }
+
+      auto rc = read_cb(cb_arg, &value_, len);
+      if (rc >= 0) {
+         LOG_DBG("Loaded %s: %d bytes", key_, len);
+         return 0;
+      }
+
+      return rc;
+   }
+
+   const T &get() const { return value_; }
+
+   bool set(const T &value) {
+      value_ = value;
+
+      int res = settings_save_one(path_, &value_, sizeof(value_));
+      if (res) {
+         LOG_ERR("settings_save_one(%s) failed: %d", key_, res);
+      }
+
+      return res == 0;
+   }
+
+#if CONFIG_SHELL
+   int shell(const struct shell *sh, const char **argv, std::size_t argc) override {
+      ARG_UNUSED(argv);
+
+      if (argc == 1) {
+         // Get
+         shell_print(sh, "%s:", key_);
+         shell_hexdump(sh, reinterpret_cast<const std::uint8_t *>(&value_), sizeof(value_));
+         return 0;
+      }
+
+      shell_error(sh, "%s can't be set from the shell", key_);
+      return -1;
+   }
+#endif
+
+protected:
+   T value_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Configuration storage
 ////////////////////////////////////////////////////////////////////////////////
@@ -289,12 +353,23 @@ struct wifi_config {
 struct image_server_config {
    loadable_string_t address{HEI_NAME("image-server-address")};
    loadable_int<std::uint16_t> port{HEI_NAME("image-server-port")};
-   loadable_int<std::uint16_t> refresh_interval{HEI_NAME("image-server-refresh-interval")};
+   loadable_int<std::uint32_t> refresh_interval{HEI_NAME("image-server-refresh-interval")};
+   loadable_default_int<std::uint32_t> image_fingerprint{HEI_NAME("image-server-image-fingerprint"), 0};
+   loadable_default_int<std::uint16_t> quiet_start{HEI_NAME("image-server-quiet-start"), 0};
+   loadable_default_int<std::uint16_t> quiet_end{HEI_NAME("image-server-quiet-end"), 0};
+};
+
+struct display_config {
+   loadable_default_int<std::uint32_t> spi_frequency{HEI_NAME("display-spi-frequency"), 0};
+   loadable_default_int<std::uint16_t> burst_size{HEI_NAME("display-burst-size"), 0};
+   loadable_default_int<std::uint8_t> direct_formats{HEI_NAME("display-direct-formats"), 0};
+   loadable_default_struct<it8951::common::panel_info> panel_info{HEI_NAME("display-panel-info"), {}};
 };
 
 struct app_config {
    wifi_config wifi{};
    image_server_config image_server{};
+   display_config display{};
 };
 
 app_config config{};
@@ -315,6 +390,14 @@ auto all_options() {
       base(config.image_server.address),
       base(config.image_server.port),
       base(config.image_server.refresh_interval),
+      base(config.image_server.image_fingerprint),
+      base(config.image_server.quiet_start),
+      base(config.image_server.quiet_end),
+
+      base(config.display.spi_frequency),
+      base(config.display.burst_size),
+      base(config.display.direct_formats),
+      base(config.display.panel_info),
    };
 }
 
@@ -430,8 +513,65 @@ bool set(const_span_t address, std::uint16_t port, std::uint32_t interval) {
    return true;
 }
 
+std::uint16_t quiet_start() {
+   return *config.image_server.quiet_start.get();
+}
+
+std::uint16_t quiet_end() {
+   return *config.image_server.quiet_end.get();
+}
+
+bool set_quiet_hours(std::uint16_t start, std::uint16_t end) {
+   return config.image_server.quiet_start.set(start) && config.image_server.quiet_end.set(end);
+}
+
+std::uint32_t image_fingerprint() {
+   return *config.image_server.image_fingerprint.get();
+}
+
+bool set_image_fingerprint(std::uint32_t fingerprint) {
+   if (image_fingerprint() == fingerprint) {
+      // Avoid wearing out the flash if nothing has changed
+      return true;
+   }
+
+   return config.image_server.image_fingerprint.set(fingerprint);
+}
+
 } // namespace image_server
 
+namespace display {
+
+std::uint32_t spi_frequency() {
+   return *config.display.spi_frequency.get();
+}
+
+std::uint16_t burst_size() {
+   return *config.display.burst_size.get();
+}
+
+bool set_calibration(std::uint32_t spi_frequency, std::uint16_t burst_size) {
+   return config.display.spi_frequency.set(spi_frequency) && config.display.burst_size.set(burst_size);
+}
+
+std::uint8_t direct_formats() {
+   return *config.display.direct_formats.get();
+}
+
+bool set_direct_formats(std::uint8_t formats) {
+   return config.display.direct_formats.set(formats);
+}
+
+it8951::common::panel_info panel_info() {
+   return config.display.panel_info.get();
+}
+
+bool set_panel_info(const it8951::common::panel_info &info) {
+   return config.display.panel_info.set(info);
+}
+
+} // namespace display
+
 bool configured() {
    for (auto o : all_options()) {
       if (!o->is_loaded()) {
@@ -548,6 +688,34 @@ int shell_is_refresh_interval(const shell *sh, size_t argc, const char **argv) {
    return config.image_server.refresh_interval.shell(sh, argv, argc);
 }
 
+int shell_is_image_fingerprint(const shell *sh, size_t argc, const char **argv) {
+   return config.image_server.image_fingerprint.shell(sh, argv, argc);
+}
+
+int shell_is_quiet_start(const shell *sh, size_t argc, const char **argv) {
+   return config.image_server.quiet_start.shell(sh, argv, argc);
+}
+
+int shell_is_quiet_end(const shell *sh, size_t argc, const char **argv) {
+   return config.image_server.quiet_end.shell(sh, argv, argc);
+}
+
+int shell_display_spi_frequency(const shell *sh, size_t argc, const char **argv) {
+   return config.display.spi_frequency.shell(sh, argv, argc);
+}
+
+int shell_display_burst_size(const shell *sh, size_t argc, const char **argv) {
+   return config.display.burst_size.shell(sh, argv, argc);
+}
+
+int shell_display_direct_formats(const shell *sh, size_t argc, const char **argv) {
+   return config.display.direct_formats.shell(sh, argv, argc);
+}
+
+int shell_display_panel_info(const shell *sh, size_t argc, const char **argv) {
+   return config.display.panel_info.shell(sh, argv, argc);
+}
+
 int dummy_help(const shell *sh, size_t argc, const char **argv) {
    if (argc == 1) {
       shell_help(sh);
@@ -597,11 +765,43 @@ SHELL_STATIC_SUBCMD_SET_CREATE(
    SHELL_CMD_ARG(addresss, NULL, "Get or set image server address", shell_image_server_address, 1, 1),
    SHELL_CMD_ARG(port, NULL, "Get or set image server port", shell_image_server_port, 1, 1),
    SHELL_CMD_ARG(refresh_interval, NULL, "Get or set image server refresh interval", shell_is_refresh_interval, 1, 1),
+   SHELL_CMD_ARG(image_fingerprint,
+                 NULL,
+                 "Get or set the fingerprint of the displayed image (0 forces a refresh)",
+                 shell_is_image_fingerprint,
+                 1,
+                 1),
+   SHELL_CMD_ARG(quiet_start,
+                 NULL,
+                 "Get or set the start of the quiet hours (minutes since midnight, equal to the end - no quiet hours)",
+                 shell_is_quiet_start,
+                 1,
+                 1),
+   SHELL_CMD_ARG(quiet_end, NULL, "Get or set the end of the quiet hours", shell_is_quiet_end, 1, 1),
+   SHELL_SUBCMD_SET_END);
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+   display_settings_commands,
+   SHELL_CMD_ARG(spi_frequency,
+                 NULL,
+                 "Get or set the calibrated display SPI clock in Hz (0 forces a calibration)",
+                 shell_display_spi_frequency,
+                 1,
+                 1),
+   SHELL_CMD_ARG(burst_size, NULL, "Get or set the calibrated display burst size", shell_display_burst_size, 1, 1),
+   SHELL_CMD_ARG(direct_formats,
+                 NULL,
+                 "Get or set the pixel formats written directly into the image buffer (bitmask, 4 - 4bpp, 8 - 8bpp)",
+                 shell_display_direct_formats,
+                 1,
+                 1),
+   SHELL_CMD_ARG(panel_info, NULL, "Get the cached display panel info", shell_display_panel_info, 1, 0),
    SHELL_SUBCMD_SET_END);
 
 SHELL_STATIC_SUBCMD_SET_CREATE(settings_commands,
                                SHELL_CMD_ARG(wifi, &wifi_commands, "Wi-Fi commands", dummy_help, 2, 0),
                                SHELL_CMD_ARG(image_server, &image_server_commands, "Image Server", dummy_help, 2, 0),
+                               SHELL_CMD_ARG(display, &display_settings_commands, "Display", dummy_help, 2, 0),
                                SHELL_CMD_ARG(print, NULL, "Print the current settings", print_current, 1, 0),
                                SHELL_SUBCMD_SET_END);
 
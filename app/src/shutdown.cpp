@@ -4,6 +4,7 @@
  * @date   Oct. 20, 2024
  */
 
+#include <hei/settings.hpp>
 #include <hei/shutdown.hpp>
 
 #include <zephyr/drivers/uart.h>
@@ -12,9 +13,13 @@
 
 #include <zephyr/sys/crc.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <concepts>
 #include <cstdint>
-#include <utility>
+#include <optional>
+#include <span>
 
 LOG_MODULE_REGISTER(shutdown, CONFIG_APP_LOG_LEVEL);
 
@@ -22,6 +27,9 @@ namespace {
 
 const device *uart_dev = DEVICE_DT_GET(DT_NODELABEL(uart2));
 
+//! The image client and the keep-alive shouldn't mix up their requests and acknowledgements
+K_MUTEX_DEFINE(uart_lock);
+
 extern "C" {
 
 int init_uart(void) {
@@ -35,32 +43,188 @@ int init_uart(void) {
 
 } // extern "C"
 
+//! Drop anything left over from the previous requests (e.g. a late acknowledgement)
+void drain_input() {
+   unsigned char byte;
+   while (uart_poll_in(uart_dev, &byte) == 0) {
+      // Nothing to do here
+   }
+}
+
+//! Request types, the second byte of the magic number
+enum class request_kind : std::uint8_t {
+   //! Payload: duration (u16 seconds)
+   shutdown = 0xAD,
+
+   //! Payload: ignored (u16)
+   status = 0xAF,
+
+   //! Payload: duration (u32 seconds), current time of day (u32 seconds since midnight, 0xFFFFFFFF - unknown),
+   //! quiet hours start and end (u16 minutes since midnight each)
+   scheduled_shutdown = 0xB1,
+};
+
+constexpr std::size_t max_payload_size = 4 + 4 + 2 + 2;
+constexpr std::uint32_t unknown_time = 0xFFFFFFFF;
+constexpr std::uint32_t seconds_per_day = 24 * 60 * 60;
+
+//! Local time as reported by the image server, and the uptime it was received at
+struct clock_sync {
+   std::uint32_t time_of_day;
+   std::int64_t uptime_ms;
+};
+
+std::optional<clock_sync> local_clock;
+
+//! Wait for the acknowledgement frame: 2 bytes magic number + 2 bytes number of forced power cutoffs + CRC of the
+//! acknowledged request
+//! @return The number of forced power cutoffs
+std::optional<std::uint16_t> wait_for_ack(std::uint8_t crc_low,
+                                          std::uint8_t crc_high,
+                                          std::chrono::milliseconds timeout) {
+   std::array<std::uint8_t, 6> received = {};
+
+   const auto deadline = k_uptime_get() + timeout.count();
+   while (k_uptime_get() < deadline) {
+      unsigned char byte;
+      if (uart_poll_in(uart_dev, &byte) != 0) {
+         k_sleep(K_MSEC(1));
+         continue;
+      }
+
+      std::shift_left(received.begin(), received.end(), 1);
+      received.back() = byte;
+
+      if (received[0] == 0xAC && received[1] == 0xCE && received[4] == crc_low && received[5] == crc_high) {
+         return static_cast<std::uint16_t>(received[2] | (received[3] << 8));
+      }
+   }
+
+   return std::nullopt;
+}
+
+//! Append a little-endian value to the frame
+template <std::unsigned_integral T>
+void write(std::uint8_t *&it, T value) {
+   for (std::size_t i = 0; i < sizeof(T); ++i) {
+      *it++ = static_cast<std::uint8_t>((value >> (i * 8)) & 0xFF);
+   }
+}
+
+std::optional<std::uint16_t> send(request_kind kind,
+                                  std::span<const std::uint8_t> payload,
+                                  std::chrono::milliseconds ack_timeout) {
+   // 2 bytes magic number + payload + 2 bytes CRC
+   std::array<std::uint8_t, 2 + max_payload_size + 2> frame{0xDE, static_cast<std::uint8_t>(kind)};
+   if (payload.size() > max_payload_size) {
+      return std::nullopt;
+   }
+
+   auto it = std::copy(payload.begin(), payload.end(), frame.begin() + 2);
+
+   const auto crc_value = crc16_ansi(frame.data(), 2 + payload.size());
+   const auto crc_low = static_cast<std::uint8_t>(crc_value & 0xFF);
+   const auto crc_high = static_cast<std::uint8_t>((crc_value >> 8) & 0xFF);
+   *it++ = crc_low;
+   *it++ = crc_high;
+
+   (void)k_mutex_lock(&uart_lock, K_FOREVER);
+
+   drain_input();
+
+   for (auto byte = frame.begin(); byte != it; ++byte) {
+      uart_poll_out(uart_dev, *byte);
+   }
+
+   auto res = wait_for_ack(crc_low, crc_high, ack_timeout);
+
+   (void)k_mutex_unlock(&uart_lock);
+   return res;
+}
+
+std::optional<std::uint16_t> send(request_kind kind, std::uint16_t value, std::chrono::milliseconds ack_timeout) {
+   std::array<std::uint8_t, 2> payload{};
+   auto it = payload.data();
+   write(it, value);
+   return send(kind, payload, ack_timeout);
+}
+
+std::atomic_bool keep_alive_enabled{false};
+
+void on_keep_alive(k_work *work);
+K_WORK_DELAYABLE_DEFINE(keep_alive_work, on_keep_alive);
+
+void on_keep_alive(k_work *work) {
+   ARG_UNUSED(work);
+
+   if (!keep_alive_enabled) {
+      return;
+   }
+
+   // Any status request starts the awake budget of the power board over, a missed one is repeated next time
+   constexpr std::chrono::milliseconds ack_timeout{CONFIG_APP_IMAGE_CLIENT_SHUTDOWN_REQUEST_DELAY_MS};
+   if (!send(request_kind::status, 0, ack_timeout)) {
+      LOG_WRN("Keep-alive not acknowledged");
+   }
+
+   (void)k_work_reschedule(&keep_alive_work, K_SECONDS(CONFIG_APP_SHUTDOWN_KEEP_ALIVE_INTERVAL));
+}
+
+//! Current local time (in seconds since midnight), if known
+std::optional<std::uint32_t> time_of_day() {
+   if (!local_clock) {
+      return std::nullopt;
+   }
+
+   const auto elapsed = (k_uptime_get() - local_clock->uptime_ms) / 1000;
+   return static_cast<std::uint32_t>((local_clock->time_of_day + elapsed) % seconds_per_day);
+}
+
 } // namespace
 
-void hei::shutdown::request(std::chrono::seconds duration) {
-   const auto num_seconds = static_cast<std::uint16_t>(duration.count());
+void hei::shutdown::set_time_of_day(std::uint32_t seconds) {
+   if (seconds >= seconds_per_day) {
+      LOG_WRN("Bad time of day: %" PRIu32, seconds);
+      return;
+   }
+
+   local_clock = clock_sync{.time_of_day = seconds, .uptime_ms = k_uptime_get()};
+}
 
-   LOG_INF("Shutting down for %d seconds", static_cast<int>(num_seconds));
+bool hei::shutdown::request(std::chrono::seconds duration, std::chrono::milliseconds ack_timeout) {
+   const auto num_seconds = static_cast<std::uint32_t>(std::clamp<std::int64_t>(duration.count(), 0, UINT32_MAX));
 
-   auto split = [](const std::uint16_t value) -> std::pair<std::uint8_t, std::uint8_t> {
-      const auto low = static_cast<std::uint8_t>(value & 0xFF);
-      const auto high = static_cast<std::uint8_t>((value >> 8) & 0xFF);
-      return {low, high};
-   };
+   const auto quiet_start = hei::settings::image_server::quiet_start();
+   const auto quiet_end = hei::settings::image_server::quiet_end();
+   const bool has_quiet_hours = quiet_start != quiet_end;
 
-   const auto seconds = split(num_seconds);
-   std::array<std::uint8_t, 6> payload = {
-      0xDE, 0xAD, seconds.first, seconds.second, 0xBE, 0xEF,
-   };
+   LOG_INF("Shutting down for %" PRIu32 " seconds", num_seconds);
 
-   // 2 bytes magic number + 2 bytes duration = 4 bytes total length
-   const auto crc_value = crc16_ansi(payload.data(), 4);
-   const auto crc = split(crc_value);
-   payload[4] = crc.first;
-   payload[5] = crc.second;
+   // Older power boards only understand the plain request, keep using it whenever possible
+   if (!has_quiet_hours && num_seconds <= UINT16_MAX) {
+      return send(request_kind::shutdown, static_cast<std::uint16_t>(num_seconds), ack_timeout).has_value();
+   }
+
+   std::array<std::uint8_t, max_payload_size> payload{};
+   auto it = payload.data();
+   write(it, num_seconds);
+   write(it, time_of_day().value_or(unknown_time));
+   write(it, quiet_start);
+   write(it, quiet_end);
+
+   return send(request_kind::scheduled_shutdown, payload, ack_timeout).has_value();
+}
+
+std::optional<std::uint16_t> hei::shutdown::forced_cutoffs(std::chrono::milliseconds ack_timeout) {
+   return send(request_kind::status, 0, ack_timeout);
+}
 
-   for (const auto byte : payload) {
-      uart_poll_out(uart_dev, byte);
+void hei::shutdown::keep_alive(bool enable) {
+   keep_alive_enabled = enable;
+   if (enable) {
+      (void)k_work_reschedule(&keep_alive_work, K_NO_WAIT);
+   } else {
+      (void)k_work_cancel_delayable(&keep_alive_work);
    }
 }
 
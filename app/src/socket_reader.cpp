@@ -0,0 +1,184 @@
+/**
+ * @file   socket_reader.cpp
+ * @author Dennis Sitelew
+ * @date   Oct. 16, 2026
+ */
+
+#include <hei/socket_reader.hpp>
+
+#include <zephyr-cpp/error.hpp>
+
+#include <zephyr/logging/log.h>
+
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <cerrno>
+
+#include <algorithm>
+#include <cstring>
+
+LOG_MODULE_REGISTER(socket_reader, CONFIG_APP_LOG_LEVEL);
+
+using namespace zephyr;
+
+namespace {
+
+auto report_error(const char *message, const int error) {
+   LOG_ERR("%s: %s", message, strerror(error));
+   return unexpected(error);
+}
+
+} // namespace
+
+namespace hei {
+
+socket_reader::socket_reader(std::chrono::seconds timeout)
+   : timeout_{timeout} {
+   // Nothing to do here
+}
+
+void socket_reader::reset(int socket) {
+   socket_ = socket;
+   head_ = 0;
+   size_ = 0;
+}
+
+void_t socket_reader::read(std::span<std::uint8_t> target) {
+   std::size_t offset = take(target);
+   while (offset != target.size()) {
+      const auto remaining = target.subspan(offset);
+      if (remaining.size() >= buffer_.size()) {
+         // Big reads go straight into the target, there is no point in copying the data twice
+         auto res = receive_some(remaining);
+         if (!res) {
+            return tl::unexpected{res.error()};
+         }
+         offset += *res;
+         continue;
+      }
+
+      if (auto res = fill(); !res) {
+         return res;
+      }
+      offset += take(remaining);
+   }
+
+   return {};
+}
+
+void_t socket_reader::skip(std::size_t num_bytes) {
+   while (true) {
+      const auto count = std::min(size_, num_bytes);
+      head_ = (head_ + count) % buffer_.size();
+      size_ -= count;
+      num_bytes -= count;
+
+      if (num_bytes == 0) {
+         return {};
+      }
+
+      if (auto res = fill(); !res) {
+         return res;
+      }
+   }
+}
+
+std::size_t socket_reader::take(std::span<std::uint8_t> target) {
+   const auto count = std::min(size_, target.size());
+
+   // The buffered data might wrap around the end of the buffer
+   const auto first = std::min(count, buffer_.size() - head_);
+   std::memcpy(target.data(), buffer_.data() + head_, first);
+   std::memcpy(target.data() + first, buffer_.data(), count - first);
+
+   head_ = (head_ + count) % buffer_.size();
+   size_ -= count;
+   return count;
+}
+
+void_t socket_reader::fill() {
+   if (size_ == 0) {
+      // Start from the beginning, so that a single read can fill the whole buffer
+      head_ = 0;
+   }
+
+   const auto tail = (head_ + size_) % buffer_.size();
+   const auto contiguous = (tail >= head_) ? buffer_.size() - tail : head_ - tail;
+
+   auto res = receive_some({buffer_.data() + tail, contiguous});
+   if (!res) {
+      return tl::unexpected{res.error()};
+   }
+   size_ += *res;
+
+   if (*res != contiguous || size_ == buffer_.size()) {
+      return {};
+   }
+
+   // We've reached the end of the buffer, pick up whatever else is already available at the beginning
+   const ssize_t num_received = ::recv(socket_, buffer_.data(), head_, MSG_DONTWAIT);
+   if (num_received > 0) {
+      size_ += num_received;
+   }
+
+   // Errors will be reported by the next read
+   return {};
+}
+
+expected<std::size_t> socket_reader::receive_some(std::span<std::uint8_t> target) {
+   fd_set read_fds{}, err_fds{};
+   timeval tv{};
+
+   while (true) {
+      FD_ZERO(&read_fds);
+      FD_ZERO(&err_fds);
+      FD_SET(socket_, &read_fds);
+      FD_SET(socket_, &err_fds);
+
+      tv.tv_sec = static_cast<decltype(tv.tv_sec)>(timeout_.count());
+      tv.tv_usec = 0;
+
+      const int activity = select(socket_ + 1, &read_fds, nullptr, &err_fds, &tv);
+      if (activity < 0) {
+         return report_error("Read select error", errno);
+      }
+
+      if (activity == 0) {
+         LOG_ERR("Receive timeout");
+         return unexpected(ETIMEDOUT);
+      }
+
+      if (FD_ISSET(socket_, &err_fds)) {
+         int error = 0;
+         socklen_t len = sizeof(error);
+         if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+            LOG_ERR("Unknown read socket error");
+            return unexpected(EIO);
+         } else if (error != 0) {
+            return report_error("Read socket error", error);
+         }
+         return unexpected(EIO);
+      }
+
+      if (!FD_ISSET(socket_, &read_fds)) {
+         continue;
+      }
+
+      const ssize_t num_received = ::read(socket_, target.data(), target.size());
+      if (num_received == 0) {
+         LOG_ERR("Read connection closed");
+         return unexpected(ECONNRESET);
+      }
+
+      if (num_received > 0) {
+         return static_cast<std::size_t>(num_received);
+      }
+
+      // ReSharper disable once CppIdenticalOperandsInBinaryExpression CppDFAConstantConditions
+      if (const int error = errno; error != EWOULDBLOCK && error != EAGAIN) {
+         return report_error("Read error", error);
+      }
+   }
+}
+
+} // namespace hei
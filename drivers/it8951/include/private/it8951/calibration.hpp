@@ -0,0 +1,25 @@
+/**
+ * @file   calibration.hpp
+ * @author Dennis Sitelew
+ * @date   Oct. 16, 2026
+ */
+
+#pragma once
+
+#include <it8951/common.hpp>
+
+#include <zephyr-cpp/expected.hpp>
+
+#include <zephyr/kernel.h>
+
+namespace it8951::calibration {
+
+//! Search for the highest SPI clock and the largest burst size, that still transfer the data correctly.
+//! Test patterns are written to a scratch SDRAM region behind the image buffer and read back.
+//! The found settings are left active.
+zephyr::expected<common::calibration> run(const device &dev);
+
+//! Use previously found transfer settings
+zephyr::void_t apply(const device &dev, const common::calibration &settings);
+
+} // namespace it8951::calibration
@@ -12,6 +12,7 @@
 #include <zephyr-cpp/expected.hpp>
 
 #include <cstdint>
+#include <span>
 
 #include <zephyr/kernel.h>
 
@@ -73,19 +74,72 @@ void_t write_command(const device &dev, command cmd, const_span_t args);
 
 void_t write_data(const device &dev, const_span_t data);
 
-// Write a maximum of CONFIG_EPD_BURST_WRITE_BUFFER_SIZE bytes
+// Write a maximum of burst_size bytes (see set_burst_size)
 void_t burst_write_one_chunk(const device &dev, std::span<const std::uint8_t> data);
 
 void_t write_data_chunked_bursts(const device &dev, std::span<const std::uint8_t> data);
 
+// Write num_bytes by sending the same chunk (of at most burst_size bytes) over and over again
+void_t write_data_repeated(const device &dev, std::span<const std::uint8_t> chunk, std::size_t num_bytes);
+
+namespace tx_buffer {
+
+//! Take a pixel buffer, that can be passed to the SPI driver as-is (DMA-capable and word-aligned)
+expected<std::span<std::uint8_t>> allocate(k_timeout_t timeout);
+
+//! Return a buffer obtained with allocate()
+void free(std::span<std::uint8_t> buffer);
+
+} // namespace tx_buffer
+
+namespace tx_queue {
+
+//! Called from the transmit thread once a queued write is done (or has failed)
+using completion_t = void (*)(const void_t &result, void *user_data);
+
+//! Queue some pixel data for writing and return right away.
+//! The data has to stay intact until the completion callback is called.
+void_t submit(const device &dev, std::span<const std::uint8_t> data, completion_t done, void *user_data);
+
+//! Wait until all the queued writes are done
+//! @return The first error encountered since the last flush
+void_t flush(const device &dev);
+
+} // namespace tx_queue
+
+//! Switch the SPI clock, should only be called while there are no queued writes
+void_t set_spi_frequency(const device &dev, std::uint32_t frequency);
+
+//! Burst sizes have to keep every chunk of a transmit buffer word-aligned, and fit the whole fill buffer
+bool valid_burst_size(std::uint16_t size);
+
+//! Change the maximal number of bytes sent in a single burst write
+void_t set_burst_size(const device &dev, std::uint16_t size);
+
 void_t write_register(const device &dev, reg reg, std::uint16_t value);
 
 void_t read_data(const device &dev, span_t data);
 
+//! Read some data as it comes over the wire (big-endian words)
+void_t read_data_raw(const device &dev, std::span<std::uint8_t> data);
+
 expected<std::uint16_t> read_register(const device &dev, reg reg);
 
 void_t enable_packed_mode(const device &dev);
 
+namespace memory {
+
+//! Read data.size() words of SDRAM starting at the address
+void_t read(const device &dev, std::uint32_t address, span_t data);
+
+//! Read the SDRAM bytes in the same order memory::write() takes them, data.size() has to be even
+void_t read(const device &dev, std::uint32_t address, std::span<std::uint8_t> data);
+
+//! Write some data to SDRAM starting at the address, using the burst writes
+void_t write(const device &dev, std::uint32_t address, std::span<const std::uint8_t> data);
+
+} // namespace memory
+
 namespace vcom {
 
 expected<std::uint16_t> get(const device &dev);
@@ -106,6 +160,41 @@ namespace image {
 void_t begin(const device &dev, const common::image::area &area, const common::image::config &config);
 void_t end(const device &dev, const common::image::area &area, const common::waveform_mode mode);
 
+// Building blocks for multi-area updates:
+// prepare() -> [load_begin() -> write data -> load_end()] * N -> refresh() -> finish()
+
+//! Wake the controller up and point it to the image buffer
+void_t prepare(const device &dev);
+
+//! Start loading the pixel data for the specified area
+void_t load_begin(const device &dev, const common::image::area &area, const common::image::config &config);
+
+//! Done loading the pixel data for the current area
+void_t load_end(const device &dev);
+
+//! Refresh the specified areas on the panel one after another
+void_t refresh(const device &dev, std::span<const common::image::area> areas, const common::waveform_mode mode);
+
+//! Wait until the panel is done with the last update, the controller has to be running.
+//! Sleeps for the expected duration of the waveform mode, and then confirms with the LUT status register.
+void_t wait(const device &dev);
+
+//! Put the controller back to sleep
+void_t finish(const device &dev);
+
+// Direct writes skip the controller's pixel format conversion, the data has to be in the image buffer layout already
+// (8bpp, the most significant byte of every little-endian word first):
+// prepare() -> load_begin_direct() -> write data -> load_end_direct() -> refresh() -> finish()
+
+//! Start writing the pixel data of an area straight into the image buffer, the area has to span the whole width
+void_t load_begin_direct(const device &dev, const common::image::area &area);
+
+//! Done writing the pixel data for the current area
+void_t load_end_direct(const device &dev);
+
+void_t begin_direct(const device &dev, const common::image::area &area);
+void_t end_direct(const device &dev, const common::image::area &area, const common::waveform_mode mode);
+
 } // namespace image
 
 } // namespace it8951::hal
\ No newline at end of file
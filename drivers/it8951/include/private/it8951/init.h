@@ -59,11 +59,29 @@ typedef struct it8951_data {
 
    //! Device information (will be filled out during initialization).
    it8951_device_info_t info;
+
+   //! SPI specifications: the active one is selected by spi_index. The SPI drivers only reconfigure the bus when they
+   //! see a different configuration object, so changing the clock at runtime switches between the two.
+   struct spi_dt_spec spi[2];
+   uint8_t spi_index;
+
+   //! Maximal number of bytes sent in a single burst write
+   uint16_t burst_size;
+
+   //! Uptime (in milliseconds) at which the last display update is expected to be done
+   int64_t refresh_done_at;
+
+   //! The panel has been reset (or verified against the cached info) and is ready for use
+   bool started;
 } it8951_data_t;
 
 //! @note Delegates the actual initialization to the init.cpp module
 int it8951_init(const struct device *dev);
 
+//! Start the panel, unless already done by it8951_init().
+//! With a cached device info (can be NULL) the reset is skipped, if the controller still reports the same info.
+int it8951_start(const struct device *dev, const it8951_device_info_t *cached_info, uint16_t cached_vcom);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -51,4 +51,10 @@ inline const it8951_config_t &get_config(const device &dev) {
    return *static_cast<const it8951_config_t *>(dev.config);
 }
 
+//! Currently active SPI specification
+inline const spi_dt_spec &get_spi(const device &dev) {
+   const auto &data = get_data(dev);
+   return data.spi[data.spi_index];
+}
+
 } // namespace it8951
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
 
 namespace it8951::common {
@@ -108,4 +109,41 @@ struct config {
 
 } // namespace image
 
+//! Time it takes to write a full frame of pixel data, with and without the controller's format conversion
+struct write_benchmark {
+   //! Load image area commands (in milliseconds)
+   std::uint32_t load_ms;
+
+   //! Direct memory burst writes (in milliseconds)
+   std::uint32_t direct_ms;
+
+   //! Both of the paths leave the same data in the image buffer
+   bool verified;
+};
+
+//! Panel information found while starting the display, can be cached for the next display::start()
+struct panel_info {
+   std::uint16_t width;
+   std::uint16_t height;
+   std::uint32_t image_buffer_address;
+
+   //! Controller firmware and LUT versions (including \0), used as the fingerprint of a cached panel info
+   std::array<char, 17> firmware_version;
+   std::array<char, 17> lut_version;
+
+   //! VCOM value the panel was started with
+   std::uint16_t vcom;
+
+   bool operator==(const panel_info &) const = default;
+};
+
+//! Transfer settings found by display::calibrate()
+struct calibration {
+   //! SPI clock in Hz
+   std::uint32_t spi_frequency;
+
+   //! Maximal number of bytes sent in a single burst write
+   std::uint16_t burst_size;
+};
+
 } // namespace it8951::common
@@ -10,9 +10,10 @@
 
 #include <zephyr-cpp/expected.hpp>
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
-#include <functional>
+#include <optional>
 #include <span>
 
 #include <zephyr/kernel.h>
@@ -25,8 +26,8 @@ class display {
 public:
    using pixel_data_t = std::span<const std::uint8_t>;
 
-   //! @return 4bpp pixel value for the specified position (x, y)
-   using pixel_func_t = std::function<std::uint8_t(std::uint16_t x, std::uint16_t y)>;
+   //! Called from the driver's transmit thread once the submitted data is written (or has failed)
+   using completion_t = void (*)(const void_t &result, void *user_data);
 
 public:
    display(const device &device);
@@ -39,30 +40,161 @@ public:
    display &operator=(display &&) = default;
 
 public:
+   //! Reset the panel and read its information, unless already done during the driver initialization
+   //! (see EPD_FAST_INIT). A panel info cached from a previous start skips the reset, as long as the controller
+   //! still reports the same one.
+   void_t start(const std::optional<common::panel_info> &cached = std::nullopt);
+
+   //! Information of the started panel, e.g. to be cached for the next start()
+   common::panel_info info() const;
+
    void_t begin(common::image::area a, common::image::config cfg);
 
    void_t update(pixel_data_t data);
 
+   //! Queue the pixel data for writing and return right away. The data has to stay intact until done is called.
+   //! Every other call waits for the queued data to be written first.
+   void_t submit(pixel_data_t data, completion_t done, void *user_data);
+
+   //! Wait until all the submitted data is written
+   //! @return The first error encountered since the last flush
+   void_t flush();
+
+   //! Take a driver-owned pixel buffer. Data in these buffers is passed to the SPI driver by update() without any
+   //! intermediate copies, so it makes sense to produce the pixel data directly in them.
+   zephyr::expected<std::span<std::uint8_t>> allocate_buffer(k_timeout_t timeout = K_NO_WAIT);
+
+   //! Return a buffer obtained with allocate_buffer()
+   void free_buffer(std::span<std::uint8_t> buffer);
+
+   //! Write num_bytes of pixel data by repeating a single 16-bit word (first byte in the lower half)
+   void_t fill(std::uint16_t word, std::size_t num_bytes);
+
    void_t end();
 
-   void_t fill_screen(pixel_func_t generator, common::waveform_mode mode);
+   // Multi-area updates: prepare() once, then begin_area() -> update() -> end_area() for every area, and finally
+   // refresh() with all the loaded areas. Disjoint areas are refreshed in parallel.
+   void_t prepare();
+   void_t begin_area(common::image::area a, common::image::config cfg);
+   void_t end_area();
+   void_t refresh(std::span<const common::image::area> areas, common::waveform_mode mode);
+
+   //! Fill the whole screen with a single 4bpp pixel value
+   void_t fill_solid(std::uint8_t pixel, common::waveform_mode mode);
+
+   //! Fill the whole screen by repeating the 4bpp pixel values, starting from the top left corner. The pattern
+   //! continues on the next row where the previous one has ended.
+   void_t fill_pattern(std::span<const std::uint8_t> pixels, common::waveform_mode mode);
+
+   //! Fill the whole screen row by row: generator(y, row) has to write a single row of packed big-endian 4bpp
+   //! pixels (two pixels per byte, the first pixel in the upper nibble)
+   template <typename RowGenerator>
+   void_t fill_rows(RowGenerator &&generator, common::waveform_mode mode);
+
+   //! Fill the whole screen pixel by pixel: generator(x, y) has to return the 4bpp pixel value
+   template <typename PixelGenerator>
+   void_t fill_screen(PixelGenerator &&generator, common::waveform_mode mode);
 
    void_t clear();
    
    void_t shutdown();
 
+   //! The display updates return as soon as the controller has started updating the panel. Wait until the panel is
+   //! actually done, e.g. before cutting the power. Sleeps through most of the update.
+   void_t wait_for_refresh();
+
    std::uint16_t width() const;
    std::uint16_t height() const;
 
+   //! Read the pixels of an area back from the controller's image buffer (8bpp, one byte per pixel, row by row).
+   //! The x position and the width have to be even. Should not be called between begin() and end().
+   void_t read_area(common::image::area a, std::span<std::uint8_t> pixels);
+
+   //! Write the pixel data of the given formats straight into the image buffer (a bitmask of BIT(pixel_format)).
+   //! Only 4bpp and 8bpp are supported, and only for full-width, unrotated, little-endian updates. Everything else
+   //! still goes through the load image area commands.
+   void set_direct_writes(std::uint8_t formats);
+   std::uint8_t direct_writes() const;
+
+   //! Compare the load image area and the direct write paths for the pixel format.
+   //! Overwrites the image buffer, but doesn't refresh the panel.
+   zephyr::expected<common::write_benchmark> benchmark(common::pixel_format format);
+
+   //! Search for the highest SPI clock and the largest burst size, that still transfer the data correctly.
+   //! Needs a free transmit buffer. The found settings are left active, and should be cached by the caller.
+   zephyr::expected<common::calibration> calibrate();
+
+   //! Use previously found transfer settings
+   void_t apply(const common::calibration &settings);
+
    common::image::area full_screen() const;
    common::image::config with_mode(common::waveform_mode mode) const;
 
+private:
+   bool use_direct_writes(const common::image::area &a, const common::image::config &cfg) const;
+   bool expand_pixels() const;
+
+   void_t write_pixels(pixel_data_t data);
+   void_t write_expanded(pixel_data_t data);
+
+   void_t upload(common::image::config cfg, bool direct, std::size_t num_bytes);
+
+   //! Start a full screen fill, returns a transmit buffer for the rows (EAGAIN if none frees up within
+   //! EPD_TX_BUFFER_TIMEOUT)
+   zephyr::expected<std::span<std::uint8_t>> begin_fill(common::waveform_mode mode);
+   void_t end_fill(std::span<std::uint8_t> buffer, void_t result);
+
 private:
    const device *device_;
    common::image::area current_area_;
    common::image::config current_config_;
 
+   //! Pixel formats written directly, and whether the current update does that
+   std::uint8_t direct_formats_{0};
+   bool direct_{false};
+
    std::array<std::uint8_t, CONFIG_EPD_BURST_WRITE_BUFFER_SIZE> fill_buffer_;
+
+   //! Packed pixels expanded into the image buffer layout, for the direct writes
+   std::array<std::uint8_t, CONFIG_EPD_DIRECT_WRITE_BUFFER_SIZE> expand_buffer_;
 };
 
+template <typename RowGenerator>
+void_t display::fill_rows(RowGenerator &&generator, common::waveform_mode mode) {
+   auto buffer = begin_fill(mode);
+   if (!buffer) {
+      return tl::unexpected{buffer.error()};
+   }
+
+   // As many complete rows as fit into the buffer are generated and written at once
+   const std::size_t row_bytes = width() / 2;
+   const std::size_t batch_rows = buffer->size() / row_bytes;
+   const std::uint16_t rows = height();
+
+   void_t res{};
+   for (std::uint16_t y = 0; y < rows && res;) {
+      const auto batch = std::min<std::size_t>(batch_rows, rows - y);
+      for (std::size_t i = 0; i < batch; ++i, ++y) {
+         generator(y, buffer->subspan(i * row_bytes, row_bytes));
+      }
+      res = update(buffer->first(batch * row_bytes));
+   }
+
+   return end_fill(*buffer, res);
+}
+
+template <typename PixelGenerator>
+void_t display::fill_screen(PixelGenerator &&generator, common::waveform_mode mode) {
+   return fill_rows(
+      [&](std::uint16_t y, std::span<std::uint8_t> row) {
+         for (std::size_t i = 0; i < row.size(); ++i) {
+            const auto x = static_cast<std::uint16_t>(i * 2);
+            const auto p0 = static_cast<std::uint8_t>(generator(x, y));
+            const auto p1 = static_cast<std::uint8_t>(generator(x + 1, y));
+            row[i] = static_cast<std::uint8_t>(p0 << 4 | (p1 & 0x0F)); // Big endian 4-bit pixels
+         }
+      },
+      mode);
+}
+
 } // namespace it8951
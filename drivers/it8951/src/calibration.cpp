@@ -0,0 +1,186 @@
+/**
+ * @file   calibration.cpp
+ * @author Dennis Sitelew
+ * @date   Oct. 16, 2026
+ */
+
+#include <it8951/calibration.hpp>
+#include <it8951/hal.hpp>
+#include <it8951/util.hpp>
+
+#include <zephyr/logging/log.h>
+
+#include <array>
+
+#include <inttypes.h>
+
+LOG_MODULE_DECLARE(it8951, CONFIG_IT8951_LOG_LEVEL);
+
+using namespace it8951;
+using namespace zephyr;
+
+namespace {
+
+//! Words read back at once while verifying
+constexpr std::size_t verify_chunk_words = 128;
+
+//! Small and fast pseudo-random generator, every round gets a different pattern
+std::uint32_t xorshift(std::uint32_t &state) {
+   state ^= state << 13U;
+   state ^= state >> 17U;
+   state ^= state << 5U;
+   return state;
+}
+
+std::uint32_t scratch_address(const device &dev) {
+   // Right behind the image buffer (one byte per pixel)
+   const auto &info = get_data(dev).info;
+   return info.image_buffer_address + static_cast<std::uint32_t>(info.panel_width) * info.panel_height;
+}
+
+void_t verify_once(const device &dev, std::span<std::uint8_t> pattern, std::uint32_t seed) {
+   std::uint32_t state = seed;
+   for (auto &byte : pattern) {
+      byte = static_cast<std::uint8_t>(xorshift(state));
+   }
+
+   const auto address = scratch_address(dev);
+   if (auto res = hal::memory::write(dev, address, pattern); !res) {
+      return res;
+   }
+
+   // Words are transferred MSB first
+   std::array<std::uint16_t, verify_chunk_words> words{};
+   for (std::size_t offset = 0; offset < pattern.size(); offset += words.size() * 2) {
+      const auto count = std::min(words.size(), (pattern.size() - offset) / 2);
+      const auto target = std::span{words}.first(count);
+      if (auto res = hal::memory::read(dev, address + offset, target); !res) {
+         return res;
+      }
+
+      for (std::size_t i = 0; i < count; ++i) {
+         const auto expected = static_cast<std::uint16_t>(pattern[offset + i * 2] << 8U | pattern[offset + i * 2 + 1]);
+         if (target[i] != expected) {
+            LOG_DBG("Mismatch at %zu: %04" PRIx16 " vs %04" PRIx16, offset + i * 2, target[i], expected);
+            return unexpected(EIO);
+         }
+      }
+   }
+
+   return {};
+}
+
+void_t verify(const device &dev, std::span<std::uint8_t> pattern) {
+   for (std::uint32_t round = 1; round <= CONFIG_EPD_CALIBRATION_ROUNDS; ++round) {
+      if (auto res = verify_once(dev, pattern, round * 0x9E3779B9U); !res) {
+         return res;
+      }
+   }
+   return {};
+}
+
+bool try_settings(const device &dev, std::span<std::uint8_t> pattern, const common::calibration &settings) {
+   auto res = calibration::apply(dev, settings).and_then([&] {
+      return verify(dev, pattern);
+   });
+
+   LOG_INF("SPI clock %" PRIu32 " Hz, burst size %" PRIu16 ": %s", settings.spi_frequency, settings.burst_size,
+           res ? "OK" : "failed");
+   return res.has_value();
+}
+
+expected<common::calibration> search(const device &dev, std::span<std::uint8_t> pattern) {
+   const auto &data = get_data(dev);
+   common::calibration best{
+      .spi_frequency = get_spi(dev).config.frequency,
+      .burst_size = data.burst_size,
+   };
+
+   // The baseline has to work, otherwise there is nothing to compare against
+   if (!try_settings(dev, pattern, best)) {
+      LOG_ERR("Transfer verification failed with the default settings");
+      return unexpected(EIO);
+   }
+
+   // Clock first: larger bursts are more likely to work at the final clock, than the other way around
+   for (auto frequency = best.spi_frequency + CONFIG_EPD_CALIBRATION_FREQUENCY_STEP;
+        frequency <= CONFIG_EPD_CALIBRATION_MAX_FREQUENCY; frequency += CONFIG_EPD_CALIBRATION_FREQUENCY_STEP) {
+      if (!try_settings(dev, pattern, {.spi_frequency = frequency, .burst_size = best.burst_size})) {
+         break;
+      }
+      best.spi_frequency = frequency;
+   }
+
+   for (std::size_t size = best.burst_size * 2U; size <= pattern.size(); size *= 2) {
+      const auto burst_size = static_cast<std::uint16_t>(size);
+      if (!try_settings(dev, pattern, {.spi_frequency = best.spi_frequency, .burst_size = burst_size})) {
+         break;
+      }
+      best.burst_size = burst_size;
+   }
+
+   // A failed attempt might leave the controller in a bad state
+   if (!try_settings(dev, pattern, best)) {
+      LOG_ERR("Transfer verification failed with the calibrated settings");
+      return unexpected(EIO);
+   }
+
+   return best;
+}
+
+} // namespace
+
+namespace it8951::calibration {
+
+expected<common::calibration> run(const device &dev) {
+   const auto &data = get_data(dev);
+   const common::calibration baseline{
+      .spi_frequency = get_spi(dev).config.frequency,
+      .burst_size = data.burst_size,
+   };
+
+   // An image transfer might still be holding the transmit buffers
+   auto buffer_res = hal::tx_buffer::allocate(K_MSEC(CONFIG_EPD_TX_BUFFER_TIMEOUT));
+   if (!buffer_res) {
+      return tl::unexpected{buffer_res.error()};
+   }
+
+   auto res = hal::system::run(dev).and_then([&] {
+      return search(dev, *buffer_res);
+   });
+
+   hal::tx_buffer::free(*buffer_res);
+
+   if (!res) {
+      (void)apply(dev, baseline);
+      return res;
+   }
+
+   return hal::system::sleep(dev).and_then([&]() -> expected<common::calibration> {
+      LOG_INF("Calibrated SPI clock %" PRIu32 " Hz, burst size %" PRIu16, res->spi_frequency, res->burst_size);
+      return *res;
+   });
+}
+
+void_t apply(const device &dev, const common::calibration &settings) {
+   if (settings.spi_frequency == 0 || settings.spi_frequency > CONFIG_EPD_CALIBRATION_MAX_FREQUENCY) {
+      LOG_ERR("Bad SPI clock: %" PRIu32, settings.spi_frequency);
+      return unexpected(EINVAL);
+   }
+
+   // Checked up front, so that the settings are either applied as a whole or not at all
+   if (!hal::valid_burst_size(settings.burst_size)) {
+      LOG_ERR("Bad burst size: %" PRIu16, settings.burst_size);
+      return unexpected(EINVAL);
+   }
+
+   return hal::tx_queue::flush(dev)
+      .and_then([&] {
+         return hal::set_spi_frequency(dev, settings.spi_frequency);
+      })
+      .and_then([&] {
+         return hal::set_burst_size(dev, settings.burst_size);
+      });
+}
+
+} // namespace it8951::calibration
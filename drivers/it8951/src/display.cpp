@@ -4,16 +4,38 @@
  * @date   Oct. 27, 2024
  */
 
+#include <it8951/calibration.hpp>
 #include <it8951/display.hpp>
 #include <it8951/hal.hpp>
 
+#include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
+#include <algorithm>
+
 LOG_MODULE_DECLARE(it8951, CONFIG_IT8951_LOG_LEVEL);
 
 using namespace it8951;
 using namespace zephyr;
 
+namespace {
+
+static_assert((CONFIG_EPD_DIRECT_WRITE_BUFFER_SIZE % 4) == 0);
+
+//! Pixel formats that can be written straight into the image buffer
+constexpr std::uint8_t supported_direct_formats = BIT(static_cast<unsigned>(common::pixel_format::pf4bpp)) |
+                                                  BIT(static_cast<unsigned>(common::pixel_format::pf8bpp));
+
+//! Expand a little-endian word of four 4bpp pixels into the image buffer layout (see hal::image::load_begin_direct)
+void expand_word(std::uint8_t lo, std::uint8_t hi, std::uint8_t *out) {
+   out[0] = hi & 0xF0;
+   out[1] = static_cast<std::uint8_t>((hi & 0x0F) << 4);
+   out[2] = lo & 0xF0;
+   out[3] = static_cast<std::uint8_t>((lo & 0x0F) << 4);
+}
+
+} // namespace
+
 display::display(const device &device)
    : device_{&device}
    , current_area_{}
@@ -21,87 +43,253 @@ display::display(const device &device)
    // Nothing to do here
 }
 
+void_t display::start(const std::optional<common::panel_info> &cached) {
+   int res;
+   if (cached) {
+      it8951_device_info_t info{
+         .panel_width = cached->width,
+         .panel_height = cached->height,
+         .image_buffer_address = cached->image_buffer_address,
+         .it8951_version = {},
+         .lut_version = {},
+      };
+      std::copy(cached->firmware_version.begin(), cached->firmware_version.end(), info.it8951_version);
+      std::copy(cached->lut_version.begin(), cached->lut_version.end(), info.lut_version);
+
+      res = it8951_start(device_, &info, cached->vcom);
+   } else {
+      res = it8951_start(device_, nullptr, 0);
+   }
+
+   if (res != 0) {
+      return unexpected(-res);
+   }
+   return {};
+}
+
+common::panel_info display::info() const {
+   const auto &info = get_data(*device_).info;
+
+   common::panel_info res{
+      .width = info.panel_width,
+      .height = info.panel_height,
+      .image_buffer_address = info.image_buffer_address,
+      .firmware_version = {},
+      .lut_version = {},
+      .vcom = static_cast<std::uint16_t>(get_config(*device_).vcom),
+   };
+   std::copy(std::begin(info.it8951_version), std::end(info.it8951_version), res.firmware_version.begin());
+   std::copy(std::begin(info.lut_version), std::end(info.lut_version), res.lut_version.begin());
+
+   return res;
+}
+
 void_t display::begin(common::image::area a, common::image::config cfg) {
    current_area_ = a;
    current_config_ = cfg;
+   direct_ = use_direct_writes(a, cfg);
+   if (direct_) {
+      return hal::image::begin_direct(*device_, a);
+   }
    return hal::image::begin(*device_, a, cfg);
 }
 
 void_t display::update(pixel_data_t data) {
-   return hal::write_data_chunked_bursts(*device_, data);
+   return flush().and_then([&] {
+      return write_pixels(data);
+   });
 }
 
-void_t display::end() {
-   return hal::image::end(*device_, current_area_, current_config_.mode);
+void_t display::submit(pixel_data_t data, completion_t done, void *user_data) {
+   if (!expand_pixels()) {
+      return hal::tx_queue::submit(*device_, data, done, user_data);
+   }
+
+   // The expansion buffer is reused, so the expanded data is written right away
+   auto res = update(data);
+   done(res, user_data);
+   return res;
 }
 
-void_t display::fill_screen(pixel_func_t generator, common::waveform_mode mode) {
-   const auto &data = get_data(*device_);
+void_t display::flush() {
+   return hal::tx_queue::flush(*device_);
+}
 
-   const common::image::area area = {
-      .x = 0,
-      .y = 0,
-      .width = data.info.panel_width,
-      .height = data.info.panel_height,
-   };
+expected<std::span<std::uint8_t>> display::allocate_buffer(k_timeout_t timeout) {
+   return hal::tx_buffer::allocate(timeout);
+}
 
-   const common::image::config config = {
-      .endianness = common::endianness::big,
-      .pixel_format = common::pixel_format::pf4bpp,
-      .rotation = common::rotation::rotate0,
-      .mode = mode,
-   };
+void display::free_buffer(std::span<std::uint8_t> buffer) {
+   hal::tx_buffer::free(buffer);
+}
 
-   // Set up
-   auto br = begin(area, config);
-   if (!br) {
-      return br;
+void_t display::fill(std::uint16_t word, std::size_t num_bytes) {
+   // The fill buffer might still be in use
+   if (auto res = flush(); !res) {
+      return res;
+   }
+
+   const auto lo = static_cast<std::uint8_t>(word & 0xFF);
+   const auto hi = static_cast<std::uint8_t>(word >> 8);
+
+   if (expand_pixels()) {
+      static_assert((CONFIG_EPD_BURST_WRITE_BUFFER_SIZE % 4) == 0);
+      for (std::size_t i = 0; i < fill_buffer_.size(); i += 4) {
+         expand_word(lo, hi, &fill_buffer_[i]);
+      }
+
+      return hal::write_data_repeated(*device_, fill_buffer_, num_bytes * 2);
    }
 
-   // Transfer data
-   std::uint16_t offset = 0;
    static_assert((CONFIG_EPD_BURST_WRITE_BUFFER_SIZE % 2) == 0);
-   for (std::uint16_t y = 0; y < data.info.panel_height; ++y) {
-      for (std::uint16_t x = 0; x < data.info.panel_width; x += 2) {
-         const auto p0 = generator(x, y);
-         const auto p1 = generator(x + 1, y);
-         fill_buffer_[offset++] = static_cast<std::uint8_t>(p0 << 4 | p1); // Big endian 4-bit pixels
-
-         if (offset == fill_buffer_.size()) {
-            auto res = hal::write_data_chunked_bursts(*device_, fill_buffer_);
-            if (!res) {
-               return res;
-            }
-
-            offset = 0;
-         }
+   for (std::size_t i = 0; i < fill_buffer_.size(); i += 2) {
+      fill_buffer_[i] = lo;
+      fill_buffer_[i + 1] = hi;
+   }
+
+   return hal::write_data_repeated(*device_, fill_buffer_, num_bytes);
+}
+
+void_t display::end() {
+   return flush().and_then([&] {
+      if (direct_) {
+         return hal::image::end_direct(*device_, current_area_, current_config_.mode);
       }
+      return hal::image::end(*device_, current_area_, current_config_.mode);
+   });
+}
+
+void_t display::prepare() {
+   return hal::image::prepare(*device_);
+}
+
+void_t display::begin_area(common::image::area a, common::image::config cfg) {
+   current_area_ = a;
+   current_config_ = cfg;
+   direct_ = use_direct_writes(a, cfg);
+   if (direct_) {
+      return hal::image::load_begin_direct(*device_, a);
    }
+   return hal::image::load_begin(*device_, a, cfg);
+}
 
-   // Write the rest of the data
-   if (offset != 0) {
-      auto res = hal::write_data_chunked_bursts(*device_, {fill_buffer_.data(), offset});
-      if (!res) {
-         return res;
+void_t display::end_area() {
+   return flush().and_then([&] {
+      if (direct_) {
+         return hal::image::load_end_direct(*device_);
       }
+      return hal::image::load_end(*device_);
+   });
+}
+
+void_t display::refresh(std::span<const common::image::area> areas, common::waveform_mode mode) {
+   return hal::image::refresh(*device_, areas, mode).and_then([&] {
+      return hal::image::finish(*device_);
+   });
+}
+
+void_t display::fill_solid(std::uint8_t pixel, common::waveform_mode mode) {
+   const auto area = full_screen();
+   const std::size_t num_bytes = static_cast<std::size_t>(area.width) * area.height / 2;
+   const auto word = static_cast<std::uint16_t>((pixel & 0x0F) * 0x1111);
+
+   return begin(area, with_mode(mode))
+      .and_then([&] {
+         return fill(word, num_bytes);
+      })
+      .and_then([&] {
+         return end();
+      });
+}
+
+void_t display::fill_pattern(std::span<const std::uint8_t> pixels, common::waveform_mode mode) {
+   if (pixels.empty()) {
+      return unexpected(EINVAL);
+   }
+
+   // The full screen is a single run of pixels, so the pattern repeats every pixels.size() / 2 bytes
+   // (or every pixels.size() bytes for an odd number of pixels)
+   const std::size_t period = (pixels.size() % 2 == 0) ? pixels.size() / 2 : pixels.size();
+   if (period > fill_buffer_.size()) {
+      const std::size_t row = width();
+      return fill_screen(
+         [&](std::uint16_t x, std::uint16_t y) {
+            return pixels[(row * y + x) % pixels.size()];
+         },
+         mode);
+   }
+
+   const auto area = full_screen();
+   const std::size_t num_bytes = static_cast<std::size_t>(area.width) * area.height / 2;
+
+   return begin(area, with_mode(mode))
+      .and_then([&] {
+         return flush();
+      })
+      .and_then([&] {
+         // Pack the pattern once, and replay it for the whole screen
+         const std::size_t chunk = fill_buffer_.size() / period * period;
+         for (std::size_t i = 0; i < chunk; ++i) {
+            const auto p0 = pixels[(i * 2) % pixels.size()];
+            const auto p1 = pixels[(i * 2 + 1) % pixels.size()];
+            fill_buffer_[i] = static_cast<std::uint8_t>(p0 << 4 | (p1 & 0x0F)); // Big endian 4-bit pixels
+         }
+
+         return hal::write_data_repeated(*device_, {fill_buffer_.data(), chunk}, num_bytes);
+      })
+      .and_then([&] {
+         return end();
+      });
+}
+
+expected<std::span<std::uint8_t>> display::begin_fill(common::waveform_mode mode) {
+   // An image transfer might still be holding the transmit buffers, don't wait for it forever
+   auto buffer = allocate_buffer(K_MSEC(CONFIG_EPD_TX_BUFFER_TIMEOUT));
+   if (!buffer) {
+      return buffer;
+   }
+
+   if (buffer->size() < width() / 2u) {
+      LOG_ERR("Transmit buffer is too small for a single row");
+      free_buffer(*buffer);
+      return unexpected(ENOMEM);
+   }
+
+   if (auto res = begin(full_screen(), with_mode(mode)); !res) {
+      free_buffer(*buffer);
+      return tl::unexpected{res.error()};
+   }
+
+   return buffer;
+}
+
+void_t display::end_fill(std::span<std::uint8_t> buffer, void_t result) {
+   free_buffer(buffer);
+   if (!result) {
+      return result;
    }
 
-   // Flush
    return end();
 }
 
 void_t display::clear() {
-   return fill_screen(
-      [](auto x, auto y) {
-         return 0xFF;
-      },
-      common::waveform_mode::init);
+   return fill_solid(0x0F, common::waveform_mode::init);
 }
 
 void_t display::shutdown() {
    return hal::system::sleep(*device_);
 }
 
+void_t display::wait_for_refresh() {
+   return hal::system::run(*device_)
+      .and_then([&] {
+         return hal::image::wait(*device_);
+      })
+      .and_then([&] {
+         return hal::system::sleep(*device_);
+      });
+}
+
 std::uint16_t display::width() const {
    return get_data(*device_).info.panel_width;
 }
@@ -110,6 +298,183 @@ std::uint16_t display::height() const {
    return get_data(*device_).info.panel_height;
 }
 
+void_t display::read_area(common::image::area a, std::span<std::uint8_t> pixels) {
+   const auto &info = get_data(*device_).info;
+   const std::size_t num_pixels = static_cast<std::size_t>(a.width) * a.height;
+   if ((a.x % 2) != 0 || (a.width % 2) != 0 || a.x + a.width > info.panel_width || a.y + a.height > info.panel_height ||
+       pixels.size() < num_pixels) {
+      LOG_ERR("Bad read area");
+      return unexpected(EINVAL);
+   }
+
+   auto read_rows = [&]() -> void_t {
+      const auto address = [&](std::uint16_t row) {
+         return info.image_buffer_address + static_cast<std::uint32_t>(a.y + row) * info.panel_width + a.x;
+      };
+
+      // Full-width rows are contiguous
+      if (a.width == info.panel_width) {
+         return hal::memory::read(*device_, address(0), pixels.first(num_pixels));
+      }
+
+      for (std::uint16_t row = 0; row < a.height; ++row) {
+         auto res = hal::memory::read(*device_, address(row), pixels.subspan(row * a.width, a.width));
+         if (!res) {
+            return res;
+         }
+      }
+      return {};
+   };
+
+   return hal::system::run(*device_)
+      .and_then(read_rows)
+      .and_then([&] {
+         return hal::system::sleep(*device_);
+      })
+      .and_then([&]() -> void_t {
+         // The controller sends the most significant byte of every (little-endian) word first
+         for (std::size_t i = 0; i < num_pixels; i += 2) {
+            std::swap(pixels[i], pixels[i + 1]);
+         }
+         return {};
+      });
+}
+
+void display::set_direct_writes(std::uint8_t formats) {
+   direct_formats_ = formats & supported_direct_formats;
+}
+
+std::uint8_t display::direct_writes() const {
+   return direct_formats_;
+}
+
+expected<common::write_benchmark> display::benchmark(common::pixel_format format) {
+   if ((BIT(static_cast<unsigned>(format)) & supported_direct_formats) == 0) {
+      LOG_ERR("No direct writes for pixel format %d", static_cast<int>(format));
+      return unexpected(EINVAL);
+   }
+
+   const common::image::config cfg = {
+      .endianness = common::endianness::little,
+      .pixel_format = format,
+      .rotation = common::rotation::rotate0,
+      .mode = common::waveform_mode::init,
+   };
+
+   const auto &info = get_data(*device_).info;
+   const auto num_pixels = static_cast<std::size_t>(info.panel_width) * info.panel_height;
+   const auto num_bytes = (format == common::pixel_format::pf4bpp) ? num_pixels / 2 : num_pixels;
+
+   // Compare the beginning of the first row, the pattern repeats anyway
+   const auto half = expand_buffer_.size() / 2;
+   const common::image::area sample = {
+      .x = 0,
+      .y = 0,
+      .width = static_cast<std::uint16_t>(std::min<std::size_t>(info.panel_width, half)),
+      .height = 1,
+   };
+   std::span<std::uint8_t> loaded{expand_buffer_.data(), sample.width};
+   std::span<std::uint8_t> written{expand_buffer_.data() + half, sample.width};
+
+   common::write_benchmark result{};
+   auto timed = [&](bool direct, std::uint32_t &ms) -> void_t {
+      const auto start = k_uptime_get();
+      auto res = upload(cfg, direct, num_bytes);
+      ms = static_cast<std::uint32_t>(k_uptime_get() - start);
+      return res;
+   };
+
+   auto res = timed(false, result.load_ms)
+                 .and_then([&] {
+                    return read_area(sample, loaded);
+                 })
+                 .and_then([&] {
+                    return timed(true, result.direct_ms);
+                 })
+                 .and_then([&] {
+                    return read_area(sample, written);
+                 });
+   direct_ = false;
+   if (!res) {
+      return tl::unexpected{res.error()};
+   }
+
+   result.verified = std::equal(loaded.begin(), loaded.end(), written.begin());
+   return result;
+}
+
+expected<common::calibration> display::calibrate() {
+   return calibration::run(*device_);
+}
+
+void_t display::apply(const common::calibration &settings) {
+   return calibration::apply(*device_, settings);
+}
+
+bool display::use_direct_writes(const common::image::area &a, const common::image::config &cfg) const {
+   const auto format = BIT(static_cast<unsigned>(cfg.pixel_format));
+   return (direct_formats_ & format) != 0 && cfg.endianness == common::endianness::little &&
+          cfg.rotation == common::rotation::rotate0 && a.x == 0 && a.width == width();
+}
+
+bool display::expand_pixels() const {
+   return direct_ && current_config_.pixel_format == common::pixel_format::pf4bpp;
+}
+
+void_t display::write_pixels(pixel_data_t data) {
+   if (expand_pixels()) {
+      return write_expanded(data);
+   }
+   return hal::write_data_chunked_bursts(*device_, data);
+}
+
+void_t display::write_expanded(pixel_data_t data) {
+   if ((data.size() % 2) != 0) {
+      LOG_ERR("Odd number of pixel bytes: %zu", data.size());
+      return unexpected(EINVAL);
+   }
+
+   const auto chunk_size = expand_buffer_.size() / 2;
+   while (!data.empty()) {
+      const auto chunk = data.first(std::min(chunk_size, data.size()));
+      for (std::size_t i = 0; i < chunk.size(); i += 2) {
+         expand_word(chunk[i], chunk[i + 1], &expand_buffer_[i * 2]);
+      }
+
+      auto res = hal::write_data_chunked_bursts(*device_, {expand_buffer_.data(), chunk.size() * 2});
+      if (!res) {
+         return res;
+      }
+      data = data.subspan(chunk.size());
+   }
+
+   return {};
+}
+
+void_t display::upload(common::image::config cfg, bool direct, std::size_t num_bytes) {
+   const auto a = full_screen();
+   current_area_ = a;
+   current_config_ = cfg;
+   direct_ = direct;
+
+   // A word of four distinct nibbles, to catch any byte or pixel order mix-ups
+   constexpr std::uint16_t pattern = 0xC35A;
+
+   return hal::image::prepare(*device_)
+      .and_then([&] {
+         return direct ? hal::image::load_begin_direct(*device_, a) : hal::image::load_begin(*device_, a, cfg);
+      })
+      .and_then([&] {
+         return fill(pattern, num_bytes);
+      })
+      .and_then([&] {
+         return end_area();
+      })
+      .and_then([&] {
+         return hal::image::finish(*device_);
+      });
+}
+
 common::image::area display::full_screen() const {
    const auto &data = get_data(*device_);
    return {
@@ -13,6 +13,9 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <optional>
 
 #include <inttypes.h>
@@ -24,6 +27,50 @@ namespace {
 using namespace it8951;
 using namespace zephyr;
 
+static_assert((CONFIG_EPD_BURST_WRITE_BUFFER_SIZE % 4) == 0, "Burst chunks should stay word-aligned");
+static_assert((CONFIG_EPD_TX_BUFFER_SIZE % 4) == 0, "Transmit buffers should be word-aligned");
+
+// Regular internal RAM is DMA-capable, the slab takes care of the alignment
+K_MEM_SLAB_DEFINE_STATIC(tx_buffers, CONFIG_EPD_TX_BUFFER_SIZE, CONFIG_EPD_TX_BUFFER_COUNT, 4);
+
+#ifdef CONFIG_EPD_TX_QUEUE
+struct tx_request {
+   const device *dev;
+   std::span<const std::uint8_t> data;
+   hal::tx_queue::completion_t done;
+   void *user_data;
+};
+
+K_MSGQ_DEFINE(tx_requests, sizeof(tx_request), CONFIG_EPD_TX_QUEUE_DEPTH, alignof(tx_request));
+
+//! First error encountered by the transmit thread since the last flush (0 - no error)
+std::atomic_int tx_failure{0};
+
+//! Signalled by the transmit thread once the pixel data is sent
+k_poll_signal tx_done_signal = K_POLL_SIGNAL_INITIALIZER(tx_done_signal);
+
+//! Wait for the asynchronous transfer to finish. Has to be called before releasing CS: a timed out transfer is still
+//! using the bus, and the next one would overlap it.
+void_t wait_for_transfer(const device &dev) {
+   auto res = spi::wait(tx_done_signal, K_MSEC(CONFIG_EPD_READY_LINE_TIMEOUT));
+   if (res || res.error().value() != EAGAIN) {
+      return res;
+   }
+
+   LOG_WRN("SPI transfer timeout, draining");
+   res = spi::wait(tx_done_signal, K_MSEC(CONFIG_EPD_READY_LINE_TIMEOUT));
+   if (res || res.error().value() != EAGAIN) {
+      // The data has made it through eventually, but it's too late for the controller to make sense of it
+      return unexpected(ETIMEDOUT);
+   }
+
+   // Neither the bus nor the controller can be trusted anymore, refuse any further transfers until the next start
+   LOG_ERR("SPI transfer stuck, the display has to be started again");
+   get_data(dev).started = false;
+   return unexpected(EIO);
+}
+#endif // CONFIG_EPD_TX_QUEUE
+
 template <typename T>
 inline auto u16(T v) {
    return static_cast<std::uint16_t>(v);
@@ -34,6 +81,11 @@ inline auto u8(T v) {
    return static_cast<std::uint8_t>(v);
 }
 
+//! Raw view of the words, as they are transferred
+inline std::span<std::uint8_t> as_bytes(span_t data) {
+   return {reinterpret_cast<std::uint8_t *>(data.data()), data.size_bytes()};
+}
+
 void_t wait_for_ready_state(const struct device &dev, k_timeout_t timeout = K_MSEC(CONFIG_EPD_READY_LINE_TIMEOUT)) {
    auto &data = get_data(dev);
    const uint32_t events = k_event_wait(&data.state, it8951_ready, false, timeout);
@@ -44,9 +96,31 @@ void_t wait_for_ready_state(const struct device &dev, k_timeout_t timeout = K_MS
    return {};
 }
 
+//! Update time of a waveform mode (see common::waveform_mode), in milliseconds
+std::int64_t update_time_ms(common::waveform_mode mode) {
+   switch (mode) {
+      case common::waveform_mode::init:
+         return 2000;
+
+      case common::waveform_mode::direct_update:
+         return 260;
+
+      default:
+         return 450;
+   }
+}
+
 void_t wait_for_display_ready(const struct device &dev,
                               k_timeout_t timeout = K_MSEC(CONFIG_EPD_DISPLAY_READY_TIMEOUT)) {
    const auto deadline = k_uptime_ticks() + timeout.ticks;
+
+   // No point in asking the controller before the last update is expected to be done, a single status read should
+   // be enough after that
+   const auto &data = get_data(dev);
+   if (const auto remaining = data.refresh_done_at - k_uptime_get(); remaining > 0) {
+      k_sleep(K_MSEC(remaining));
+   }
+
    while (k_uptime_ticks() < deadline) {
       auto read_res = hal::read_register(dev, hal::reg::lutafsr);
       if (!read_res) {
@@ -58,13 +132,37 @@ void_t wait_for_display_ready(const struct device &dev,
          return {};
       }
 
-      k_sleep(K_MSEC(1));
+      k_sleep(K_MSEC(CONFIG_EPD_DISPLAY_READY_POLL_INTERVAL));
    }
 
    LOG_WRN("Display ready timeout");
    return unexpected(EBUSY);
 }
 
+//! Wait until at least one of the LUT engines is idle (every busy engine has its bit set in lutafsr)
+void_t wait_for_free_lut(const struct device &dev, k_timeout_t timeout = K_MSEC(CONFIG_EPD_DISPLAY_READY_TIMEOUT)) {
+   const auto deadline = k_uptime_ticks() + timeout.ticks;
+   while (k_uptime_ticks() < deadline) {
+      auto read_res = hal::read_register(dev, hal::reg::lutafsr);
+      if (!read_res) {
+         return tl::unexpected{read_res.error()};
+      }
+
+      if (std::popcount(*read_res) < CONFIG_EPD_LUT_ENGINES) {
+         return {};
+      }
+
+      k_sleep(K_MSEC(CONFIG_EPD_DISPLAY_READY_POLL_INTERVAL));
+   }
+
+   LOG_WRN("LUT engine timeout");
+   return unexpected(EBUSY);
+}
+
+bool overlap(const common::image::area &a, const common::image::area &b) {
+   return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
 class cs_control {
 private:
    cs_control(const it8951_config_t &cfg)
@@ -115,12 +213,14 @@ private:
    const it8951_config_t *cfg_;
 };
 
-//! Write a single word (16 bits), assuming the CS line is held.
-void_t write_word(const device &dev, std::uint16_t word) {
-   std::array data{u8((word >> 8U) & 0xFF), u8(word & 0xFF)};
+//! Maximal number of words sent in a single SPI transfer (preamble included)
+constexpr std::size_t max_batch_words = 16;
+
+//! Send some already encoded words in a single SPI transfer, assuming the CS line is held.
+void_t write_encoded(const device &dev, std::span<std::uint16_t> words) {
    const spi_buf tx_buf = {
-      .buf = data.data(),
-      .len = data.size(),
+      .buf = words.data(),
+      .len = words.size_bytes(),
    };
 
    const struct spi_buf_set tx_buf_set = {
@@ -128,26 +228,37 @@ void_t write_word(const device &dev, std::uint16_t word) {
       .count = 1,
    };
 
-   return spi::write(get_config(dev).spi, tx_buf_set);
+   return spi::write(get_spi(dev), tx_buf_set);
 }
 
-//! Write some data assuming the CS line is held.
-void_t write(const device &dev, const_span_t data) {
-   for (const auto word : data) {
-      auto res = wait_for_ready_state(dev).and_then([&] {
-         return write_word(dev, word);
-      });
-
+//! Write a preamble followed by some data, assuming the CS line is held.
+//! The ready line is only checked before taking the CS line: the preamble and the words following it are
+//! sent back-to-back, the same way the burst writes do it.
+void_t write(const device &dev, hal::preamble preamble, const_span_t data) {
+   std::array<std::uint16_t, max_batch_words> buffer{};
+   buffer[0] = encoding::from_host(u16(preamble));
+
+   std::size_t used = 1;
+   std::size_t offset = 0;
+   do {
+      const auto count = std::min(buffer.size() - used, data.size() - offset);
+      const auto source = data.subspan(offset, count);
+      std::transform(source.begin(), source.end(), buffer.begin() + used, encoding::from_host);
+
+      auto res = write_encoded(dev, std::span{buffer}.first(used + count));
       if (!res) {
          return res;
       }
-   }
+
+      offset += count;
+      used = 0;
+   } while (offset != data.size());
+
    return {};
 }
 
-//! Read a single word (16 bits), assuming the CS line is held.
-expected<std::uint16_t> read_word(const device &dev) {
-   std::array<std::uint8_t, 2> data{};
+//! Read some data into a single buffer, assuming the CS line is held.
+void_t read_chunk(const device &dev, std::span<std::uint8_t> data) {
    const spi_buf rx_buf = {
       .buf = data.data(),
       .len = data.size(),
@@ -158,36 +269,39 @@ expected<std::uint16_t> read_word(const device &dev) {
       .count = 1,
    };
 
-   return spi::read(get_config(dev).spi, rx_buf_set).and_then([&]() -> expected<std::uint16_t> {
-      return u16(data[0]) << 8U | u16(data[1]);
-   });
+   return spi::read(get_spi(dev), rx_buf_set);
 }
 
-// Read some data, assuming the CS line is already held down
+// Read some data as it comes over the wire, assuming the CS line is already held down and the read preamble is sent.
+// Large reads are split into bursts, with a ready check before each one, the same way the writes are.
 // @note The first word is always discarded, as it will always contain garbage (junk from transferring the read request)
-void_t read(const device &dev, span_t data) {
-   auto discard_first_word = [&]() {
-      return wait_for_ready_state(dev).and_then([&] {
-         return read_word(dev);
+void_t read(const device &dev, std::span<std::uint8_t> data) {
+   std::array<std::uint8_t, 2> junk{};
+
+   // The controller needs some time to fetch the data after the preamble
+   auto res = wait_for_ready_state(dev).and_then([&] {
+      return read_chunk(dev, junk);
+   });
+
+   const std::size_t burst_size = get_data(dev).burst_size;
+   for (std::size_t i = 0; res && i < data.size(); i += burst_size) {
+      const auto remainder = std::min<std::size_t>(data.size() - i, burst_size);
+      res = wait_for_ready_state(dev).and_then([&] {
+         return read_chunk(dev, data.subspan(i, remainder));
       });
+   }
+
+   return res;
+}
+
+//! Address and count parameters of the memory burst commands
+std::array<std::uint16_t, 4> burst_args(std::uint32_t address, std::size_t num_words) {
+   return {
+      u16(address & 0xFFFF),
+      u16((address >> 16U) & 0xFFFF),
+      u16(num_words & 0xFFFF),
+      u16((num_words >> 16U) & 0xFFFF),
    };
-   return discard_first_word().and_then([&](auto _) -> void_t {
-      for (auto &word : data) {
-         auto res = wait_for_ready_state(dev)
-                       .and_then([&] {
-                          return read_word(dev);
-                       })
-                       .and_then([&](auto value) -> void_t {
-                          word = value;
-                          return {};
-                       });
-
-         if (!res) {
-            return res;
-         }
-      }
-      return {};
-   });
 }
 
 void_t set_image_buffer_base_address(const device &dev) {
@@ -219,6 +333,10 @@ void_t load_image_end(const device &dev) {
 }
 
 void_t display_area(const device &dev, const common::image::area &area, common::waveform_mode mode) {
+   // Areas might be updated in parallel, the last one to finish counts
+   auto &data = get_data(dev);
+   data.refresh_done_at = std::max(data.refresh_done_at, k_uptime_get() + update_time_ms(mode));
+
    std::array args{
       u16(area.x), u16(area.y), u16(area.width), u16(area.height), u16(mode),
    };
@@ -231,32 +349,25 @@ namespace it8951::hal {
 
 void_t write_command(const device &dev, command cmd) {
    return cs_control::take(dev).and_then([&](auto cs) {
-      return write(dev, {{u16(preamble::write_command), u16(cmd)}});
+      return write(dev, preamble::write_command, {{u16(cmd)}});
    });
 }
 
 void_t write_command(const device &dev, command cmd, const_span_t args) {
-   return write_command(dev, cmd).and_then([&]() -> void_t {
-      for (auto word : args) {
-         auto res = write_data(dev, {{word}});
-         if (!res) {
-            return res;
-         }
-      }
-      return {};
+   // The controller expects a new CS cycle for the data preamble, but all the arguments share a single one
+   return write_command(dev, cmd).and_then([&] {
+      return write_data(dev, args);
    });
 }
 
 void_t write_data(const device &dev, const_span_t data) {
    return cs_control::take(dev).and_then([&](auto cs) {
-      return write(dev, {{u16(preamble::write_data)}}).and_then([&] {
-         return write(dev, data);
-      });
+      return write(dev, preamble::write_data, data);
    });
 }
 
 void_t burst_write_one_chunk(const device &dev, std::span<const std::uint8_t> data) {
-   if (data.size() > CONFIG_EPD_BURST_WRITE_BUFFER_SIZE) {
+   if (data.size() > get_data(dev).burst_size) {
       LOG_ERR("Bad write one chunk size: %d", (int)data.size());
       return unexpected(EINVAL);
    }
@@ -277,14 +388,29 @@ void_t burst_write_one_chunk(const device &dev, std::span<const std::uint8_t> da
       .count = spi_buffers.size(),
    };
 
+#ifdef CONFIG_EPD_TX_QUEUE
+   if (!get_data(dev).started) {
+      LOG_ERR("Burst write before the display start");
+      return unexpected(EIO);
+   }
+#endif
+
    return cs_control::take(dev).and_then([&](auto cs) {
-      return spi::write(get_config(dev).spi, tx_buf_set);
+#ifdef CONFIG_EPD_TX_QUEUE
+      // Sleep on the DMA completion instead of blocking inside the SPI driver
+      return spi::write_async(get_spi(dev), tx_buf_set, tx_done_signal).and_then([&] {
+         return wait_for_transfer(dev);
+      });
+#else
+      return spi::write(get_spi(dev), tx_buf_set);
+#endif
    });
 }
 
 void_t write_data_chunked_bursts(const device &dev, std::span<const std::uint8_t> data) {
-   for (std::size_t i = 0; i < data.size(); i += CONFIG_EPD_BURST_WRITE_BUFFER_SIZE) {
-      const auto remainder = std::min<std::size_t>(data.size() - i, CONFIG_EPD_BURST_WRITE_BUFFER_SIZE);
+   const std::size_t burst_size = get_data(dev).burst_size;
+   for (std::size_t i = 0; i < data.size(); i += burst_size) {
+      const auto remainder = std::min<std::size_t>(data.size() - i, burst_size);
       auto res = burst_write_one_chunk(dev, data.subspan(i, remainder));
       if (!res) {
          return res;
@@ -293,13 +419,133 @@ void_t write_data_chunked_bursts(const device &dev, std::span<const std::uint8_t
    return {};
 }
 
+void_t write_data_repeated(const device &dev, std::span<const std::uint8_t> chunk, std::size_t num_bytes) {
+   if (chunk.empty()) {
+      return unexpected(EINVAL);
+   }
+
+   for (std::size_t i = 0; i < num_bytes; i += chunk.size()) {
+      const auto remainder = std::min<std::size_t>(num_bytes - i, chunk.size());
+      auto res = burst_write_one_chunk(dev, chunk.first(remainder));
+      if (!res) {
+         return res;
+      }
+   }
+   return {};
+}
+
+namespace tx_buffer {
+
+expected<std::span<std::uint8_t>> allocate(k_timeout_t timeout) {
+   void *block = nullptr;
+   if (const int res = k_mem_slab_alloc(&tx_buffers, &block, timeout); res != 0) {
+      LOG_ERR("Transmit buffer allocation error: %d", res);
+      return unexpected(-res);
+   }
+
+   return std::span<std::uint8_t>{static_cast<std::uint8_t *>(block), CONFIG_EPD_TX_BUFFER_SIZE};
+}
+
+void free(std::span<std::uint8_t> buffer) {
+   k_mem_slab_free(&tx_buffers, buffer.data());
+}
+
+} // namespace tx_buffer
+
+namespace tx_queue {
+
+#ifdef CONFIG_EPD_TX_QUEUE
+void_t submit(const device &dev, std::span<const std::uint8_t> data, completion_t done, void *user_data) {
+   const tx_request request{.dev = &dev, .data = data, .done = done, .user_data = user_data};
+   if (const int res = k_msgq_put(&tx_requests, &request, K_FOREVER); res != 0) {
+      LOG_ERR("Transmit queue error: %d", res);
+      return unexpected(-res);
+   }
+   return {};
+}
+
+void_t flush(const device &dev) {
+   // The marker request is only completed after everything queued before it
+   k_sem flushed{};
+   k_sem_init(&flushed, 0, 1);
+
+   auto res = submit(dev, {}, [](const void_t &, void *user_data) {
+      k_sem_give(static_cast<k_sem *>(user_data));
+   }, &flushed);
+   if (!res) {
+      return res;
+   }
+
+   (void)k_sem_take(&flushed, K_FOREVER);
+   if (const auto error = tx_failure.exchange(0)) {
+      return unexpected(error);
+   }
+   return {};
+}
+#else
+void_t submit(const device &dev, std::span<const std::uint8_t> data, completion_t done, void *user_data) {
+   // No transmit thread: write right away, the result is only reported through the callback
+   done(write_data_chunked_bursts(dev, data), user_data);
+   return {};
+}
+
+void_t flush(const device &dev) {
+   ARG_UNUSED(dev);
+   return {};
+}
+#endif // CONFIG_EPD_TX_QUEUE
+
+} // namespace tx_queue
+
+void_t set_spi_frequency(const device &dev, std::uint32_t frequency) {
+   auto &data = get_data(dev);
+   const auto &current = data.spi[data.spi_index];
+   if (current.config.frequency == frequency) {
+      return {};
+   }
+
+   // The bus is locked to the current configuration (SPI_LOCK_ON)
+   if (const int res = spi_release_dt(&current); res != 0) {
+      LOG_ERR("SPI release error: %d", res);
+      return unexpected(-res);
+   }
+
+   const auto next = static_cast<std::uint8_t>(data.spi_index ^ 1U);
+   data.spi[next] = current;
+   data.spi[next].config.frequency = frequency;
+   data.spi_index = next;
+   return {};
+}
+
+bool valid_burst_size(std::uint16_t size) {
+   // Every chunk of a transmit buffer should start word-aligned, and the repeated writes use the fill buffer as-is
+   return (size % 4) == 0 && size >= CONFIG_EPD_BURST_WRITE_BUFFER_SIZE && size <= CONFIG_EPD_TX_BUFFER_SIZE;
+}
+
+void_t set_burst_size(const device &dev, std::uint16_t size) {
+   if (!valid_burst_size(size)) {
+      LOG_ERR("Bad burst size: %" PRIu16, size);
+      return unexpected(EINVAL);
+   }
+
+   get_data(dev).burst_size = size;
+   return {};
+}
+
 void_t write_register(const device &dev, reg reg, std::uint16_t value) {
    return write_command(dev, command::register_write, {{u16(reg), value}});
 }
 
 void_t read_data(const device &dev, span_t data) {
+   return read_data_raw(dev, as_bytes(data)).and_then([&]() -> void_t {
+      std::transform(data.begin(), data.end(), data.begin(), encoding::to_host);
+      return {};
+   });
+}
+
+void_t read_data_raw(const device &dev, std::span<std::uint8_t> data) {
    return cs_control::take(dev).and_then([&](auto cs) {
-      return write(dev, {{u16(preamble::read_data)}}).and_then([&] {
+      return write(dev, preamble::read_data, {}).and_then([&] {
          return read(dev, data);
       });
    });
@@ -318,6 +564,48 @@ void_t enable_packed_mode(const device &dev) {
    return write_register(dev, reg::i80cpcr, 0x0001);
 }
 
+namespace memory {
+
+void_t read(const device &dev, std::uint32_t address, span_t data) {
+   return read(dev, address, as_bytes(data)).and_then([&]() -> void_t {
+      std::transform(data.begin(), data.end(), data.begin(), encoding::to_host);
+      return {};
+   });
+}
+
+void_t read(const device &dev, std::uint32_t address, std::span<std::uint8_t> data) {
+   if ((data.size() % 2) != 0) {
+      return unexpected(EINVAL);
+   }
+
+   return write_command(dev, command::memory_burst_read_trigger, burst_args(address, data.size() / 2))
+      .and_then([&] {
+         return write_command(dev, command::memory_burst_read_start);
+      })
+      .and_then([&] {
+         return read_data_raw(dev, data);
+      })
+      .and_then([&] {
+         return write_command(dev, command::memory_burst_end);
+      });
+}
+
+void_t write(const device &dev, std::uint32_t address, std::span<const std::uint8_t> data) {
+   if ((data.size() % 2) != 0) {
+      return unexpected(EINVAL);
+   }
+
+   return write_command(dev, command::memory_burst_write, burst_args(address, data.size() / 2))
+      .and_then([&] {
+         return write_data_chunked_bursts(dev, data);
+      })
+      .and_then([&] {
+         return write_command(dev, command::memory_burst_end);
+      });
+}
+
+} // namespace memory
+
 namespace vcom {
 
 expected<std::uint16_t> get(const device &dev) {
@@ -365,41 +653,165 @@ void_t power(const device &dev, bool is_on) {
 namespace image {
 
 void_t begin(const device &dev, const common::image::area &area, const common::image::config &config) {
-   return system::run(dev)
-      .and_then([&] {
-         return wait_for_display_ready(dev);
-      })
+   return prepare(dev).and_then([&] {
+      return load_begin(dev, area, config);
+   });
+}
+
+void_t end(const device &dev, const common::image::area &area, const common::waveform_mode mode) {
+   return load_end(dev)
       .and_then([&] {
-         return enable_packed_mode(dev);
+         return display_area(dev, area, mode);
       })
       .and_then([&] {
-         return set_image_buffer_base_address(dev);
+         // Make sure we exit this function with the display in the ready state this way we can be sure that the
+         // panel has finished rendering the new image.
+         return wait_for_ready_state(dev);
       })
       .and_then([&] {
-         return load_image_area_start(dev, area, config);
+         return finish(dev);
       });
 }
 
-void_t end(const device &dev, const common::image::area &area, const common::waveform_mode mode) {
-   return load_image_end(dev)
+void_t begin_direct(const device &dev, const common::image::area &area) {
+   return prepare(dev).and_then([&] {
+      return load_begin_direct(dev, area);
+   });
+}
+
+void_t end_direct(const device &dev, const common::image::area &area, const common::waveform_mode mode) {
+   return load_end_direct(dev)
       .and_then([&] {
          return display_area(dev, area, mode);
       })
       .and_then([&] {
-         // Make sure we exit this function with the display in the ready state this way we can be sure that the
-         // panel has finished rendering the new image.
          return wait_for_ready_state(dev);
       })
       .and_then([&] {
-         // Afterward we put the driver board into sleep mode and again wait until it is ready. This way we can avoid
-         // a potential burn-out of the driver board itself.
-         return system::sleep(dev);
+         return finish(dev);
+      });
+}
+
+void_t prepare(const device &dev) {
+   return system::run(dev)
+      .and_then([&] {
+         return wait_for_display_ready(dev);
       })
       .and_then([&] {
-         return wait_for_ready_state(dev);
+         return enable_packed_mode(dev);
+      })
+      .and_then([&] {
+         return set_image_buffer_base_address(dev);
+      });
+}
+
+void_t load_begin(const device &dev, const common::image::area &area, const common::image::config &config) {
+   return load_image_area_start(dev, area, config);
+}
+
+void_t load_end(const device &dev) {
+   return load_image_end(dev);
+}
+
+void_t load_begin_direct(const device &dev, const common::image::area &area) {
+   const auto &info = get_data(dev).info;
+   if (area.x != 0 || area.width != info.panel_width) {
+      LOG_ERR("Direct writes need full-width areas");
+      return unexpected(EINVAL);
+   }
+
+   const auto address = info.image_buffer_address + static_cast<std::uint32_t>(area.y) * info.panel_width;
+   const auto num_words = static_cast<std::size_t>(area.width) * area.height / 2;
+   return write_command(dev, command::memory_burst_write, burst_args(address, num_words));
+}
+
+void_t load_end_direct(const device &dev) {
+   return write_command(dev, command::memory_burst_end);
+}
+
+void_t refresh(const device &dev, std::span<const common::image::area> areas, const common::waveform_mode mode) {
+   // Disjoint areas are updated in parallel, each one by a separate LUT engine. An area overlapping any of the areas
+   // still in progress has to wait until all of them are done.
+   std::size_t batch_start = 0;
+   for (std::size_t i = 0; i < areas.size(); ++i) {
+      const auto &area = areas[i];
+      const auto batch = areas.subspan(batch_start, i - batch_start);
+      const bool overlaps = std::any_of(batch.begin(), batch.end(), [&](const auto &other) {
+         return overlap(area, other);
+      });
+
+      void_t res;
+      if (i == 0 || overlaps) {
+         res = wait_for_display_ready(dev);
+         batch_start = i;
+      } else {
+         res = wait_for_free_lut(dev);
+      }
+
+      res = res.and_then([&] {
+         return display_area(dev, area, mode);
       });
+
+      if (!res) {
+         return res;
+      }
+   }
+
+   return wait_for_ready_state(dev);
+}
+
+void_t wait(const device &dev) {
+   return wait_for_display_ready(dev);
+}
+
+void_t finish(const device &dev) {
+   // Put the driver board into sleep mode and again wait until it is ready. This way we can avoid a potential
+   // burn-out of the driver board itself.
+   return system::sleep(dev).and_then([&] {
+      return wait_for_ready_state(dev);
+   });
 }
 
 } // namespace image
 
 } // namespace it8951::hal
+
+#ifdef CONFIG_EPD_TX_QUEUE
+namespace {
+
+[[noreturn]] void tx_thread_fn(void *p1, void *p2, void *p3) {
+   ARG_UNUSED(p1);
+   ARG_UNUSED(p2);
+   ARG_UNUSED(p3);
+
+   while (true) {
+      tx_request request{};
+      (void)k_msgq_get(&tx_requests, &request, K_FOREVER);
+
+      // Skip the writes after a failure, until the next flush picks the error up
+      void_t res{};
+      if (const auto error = tx_failure.load()) {
+         res = unexpected(error);
+      } else if (res = hal::write_data_chunked_bursts(*request.dev, request.data); !res) {
+         int expected = 0;
+         tx_failure.compare_exchange_strong(expected, res.error().value() != 0 ? res.error().value() : EIO);
+      }
+
+      request.done(res, request.user_data);
+   }
+}
+
+// ReSharper disable once CppDeclaratorNeverUsed
+// NOLINTNEXTLINE(*-misplaced-const)
+K_THREAD_DEFINE(it8951_tx_thread_id,
+                CONFIG_EPD_TX_THREAD_STACK_SIZE,
+                tx_thread_fn,
+                nullptr,
+                nullptr,
+                nullptr,
+                CONFIG_EPD_TX_THREAD_PRIORITY,
+                0,
+                0);
+
+} // namespace
+#endif // CONFIG_EPD_TX_QUEUE
@@ -15,6 +15,8 @@
 
 #include <it8951/init.h>
 
+#include <cstring>
+
 LOG_MODULE_REGISTER(it8951, CONFIG_IT8951_LOG_LEVEL);
 
 using namespace it8951;
@@ -132,25 +134,41 @@ void_t read_device_info(const device &dev, it8951_device_info_t &info) {
    });
 }
 
-expected<void> try_init(const device &dev) {
-   const auto &cfg = get_config(dev);
+bool same_device_info(const it8951_device_info_t &lhs, const it8951_device_info_t &rhs) {
+   auto same_string = [](const char *a, const char *b) {
+      return std::strncmp(a, b, sizeof(it8951_device_info_t::it8951_version)) == 0;
+   };
+
+   return lhs.panel_width == rhs.panel_width && lhs.panel_height == rhs.panel_height &&
+          lhs.image_buffer_address == rhs.image_buffer_address &&
+          same_string(lhs.it8951_version, rhs.it8951_version) && same_string(lhs.lut_version, rhs.lut_version);
+}
+
+void_t finish_start(const device &dev) {
    auto &data = get_data(dev);
 
-   data.dev = &dev;
+   // Only at this point are we sure that we have a functioning board
+   auto &info = data.info;
+   LOG_DBG(
+      "Display info:\r\n"
+      "\tWidth  = %d\r\n"
+      "\tHeight = %d\r\n"
+      "\tBuffer Address: 0x%x\r\n"
+      "\tFW Version: %s\r\n"
+      "\tLUT Version: %s",
+      info.panel_width, info.panel_height, info.image_buffer_address, info.it8951_version, info.lut_version);
+
+   return hal::system::sleep(dev).and_then([&]() -> void_t {
+      data.started = true;
+      return {};
+   });
+}
 
-   return setup_ready_pin(dev)
-      .and_then([&] {
-         return check_and_init_output_pin(cfg.reset_pin, false);
-      })
-      .and_then([&] {
-         return check_and_init_output_pin(cfg.cs_pin, false);
-      })
-      .and_then([&] {
-         return spi::ready(cfg.spi);
-      })
-      .and_then([&] {
-         return reset(cfg);
-      })
+void_t full_start(const device &dev) {
+   const auto &cfg = get_config(dev);
+   auto &data = get_data(dev);
+
+   return reset(cfg)
       .and_then([&] {
          return hal::system::run(dev);
       })
@@ -170,24 +188,91 @@ expected<void> try_init(const device &dev) {
          }
          return {};
       })
+      .and_then([&] {
+         return finish_start(dev);
+      });
+}
+
+//! Skips the reset and the VCOM read-back: reading the device info is enough to tell that the controller is up and
+//! hasn't changed since the info was cached
+void_t fast_start(const device &dev, const it8951_device_info_t &cached_info, std::uint16_t cached_vcom) {
+   const auto &cfg = get_config(dev);
+   auto &data = get_data(dev);
+
+   if (cached_vcom != static_cast<std::uint16_t>(cfg.vcom)) {
+      return unexpected(ESTALE);
+   }
+
+   return hal::system::run(dev)
+      .and_then([&] {
+         return read_device_info(dev, data.info);
+      })
       .and_then([&]() -> void_t {
-         // Only at this point are we sure that we have a functioning board
-         auto &info = data.info;
-         LOG_DBG(
-            "Display info:\r\n"
-            "\tWidth  = %d\r\n"
-            "\tHeight = %d\r\n"
-            "\tBuffer Address: 0x%x\r\n"
-            "\tFW Version: %s\r\n"
-            "\tLUT Version: %s",
-            info.panel_width, info.panel_height, info.image_buffer_address, info.it8951_version, info.lut_version);
+         if (!same_device_info(data.info, cached_info)) {
+            return unexpected(ESTALE);
+         }
          return {};
       })
       .and_then([&] {
-         return hal::system::sleep(dev);
+         return hal::enable_packed_mode(dev);
+      })
+      .and_then([&] {
+         // The controller might have lost power since, so the value is still written (just not read back)
+         return hal::vcom::set(dev, cfg.vcom);
+      })
+      .and_then([&] {
+         return finish_start(dev);
       });
 }
 
+expected<void> try_init(const device &dev) {
+   const auto &cfg = get_config(dev);
+   auto &data = get_data(dev);
+
+   data.dev = &dev;
+   data.spi[0] = cfg.spi;
+   data.spi_index = 0;
+   data.burst_size = CONFIG_EPD_BURST_WRITE_BUFFER_SIZE;
+   data.refresh_done_at = 0;
+   data.started = false;
+
+   auto res = setup_ready_pin(dev)
+                 .and_then([&] {
+                    return check_and_init_output_pin(cfg.reset_pin, false);
+                 })
+                 .and_then([&] {
+                    return check_and_init_output_pin(cfg.cs_pin, false);
+                 })
+                 .and_then([&] {
+                    return spi::ready(cfg.spi);
+                 });
+
+#if !CONFIG_EPD_FAST_INIT
+   res = res.and_then([&] {
+      return full_start(dev);
+   });
+#endif
+
+   return res;
+}
+
+expected<void> try_start(const device &dev, const it8951_device_info_t *cached_info, std::uint16_t cached_vcom) {
+   if (get_data(dev).started) {
+      return {};
+   }
+
+   if (cached_info) {
+      auto res = fast_start(dev, *cached_info, cached_vcom);
+      if (res) {
+         return res;
+      }
+
+      LOG_WRN("Cached display info not used (%s), resetting the display", res.error().message().c_str());
+   }
+
+   return full_start(dev);
+}
+
 } // namespace
 
 extern "C" {
@@ -200,4 +285,12 @@ int it8951_init(const device *dev) {
    return 0;
 }
 
+int it8951_start(const device *dev, const it8951_device_info_t *cached_info, uint16_t cached_vcom) {
+   if (auto res = try_start(*dev, cached_info, cached_vcom); !res) {
+      return -res.error().value();
+   }
+
+   return 0;
+}
+
 } // extern "C"
\ No newline at end of file
@@ -16,4 +16,13 @@ void_t ready(const spi_dt_spec &spec);
 void_t write(const spi_dt_spec &spec, const spi_buf_set &buf_set);
 void_t read(const spi_dt_spec &spec, const spi_buf_set &buf_set);
 
+#ifdef CONFIG_SPI_ASYNC
+//! Start writing and return right away, the signal is raised once the transfer is done
+void_t write_async(const spi_dt_spec &spec, const spi_buf_set &buf_set, k_poll_signal &signal);
+
+//! Wait for an asynchronous transfer to finish
+//! @return EAGAIN on timeout (the transfer is still running), or the transfer result
+void_t wait(k_poll_signal &signal, k_timeout_t timeout);
+#endif // CONFIG_SPI_ASYNC
+
 } // namespace zephyr::spi
@@ -43,4 +43,39 @@ void_t read(const spi_dt_spec &spec, const spi_buf_set &buf_set) {
    return {};
 }
 
+#ifdef CONFIG_SPI_ASYNC
+void_t write_async(const spi_dt_spec &spec, const spi_buf_set &buf_set, k_poll_signal &signal) {
+   k_poll_signal_reset(&signal);
+   if (auto err = spi_transceive_signal(spec.bus, &spec.config, &buf_set, nullptr, &signal)) {
+      LOG_ERR("SPI async write failed on %s: %d", spec.bus->name, err);
+      return unexpected(err);
+   }
+
+   return {};
+}
+
+void_t wait(k_poll_signal &signal, k_timeout_t timeout) {
+   k_poll_event event = K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &signal);
+   if (auto err = k_poll(&event, 1, timeout)) {
+      LOG_ERR("SPI transfer wait failed: %d", err);
+      return unexpected(err);
+   }
+
+   unsigned int signaled = 0;
+   int result = 0;
+   k_poll_signal_check(&signal, &signaled, &result);
+   if (!signaled) {
+      LOG_ERR("SPI transfer not signaled");
+      return unexpected(EAGAIN);
+   }
+
+   if (result != 0) {
+      LOG_ERR("SPI transfer failed: %d", result);
+      return unexpected(result);
+   }
+
+   return {};
+}
+#endif // CONFIG_SPI_ASYNC
+
 } // namespace zephyr::spi
@@ -14,10 +14,14 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/pm/device.h>
 #include <zephyr/sys/crc.h>
+#include <zephyr/sys/ring_buffer.h>
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <array>
+#include <optional>
+#include <utility>
 
 LOG_MODULE_REGISTER(shutdown, CONFIG_APP_LOG_LEVEL);
 
@@ -25,8 +29,47 @@ namespace {
 
 const device *uart_dev = DEVICE_DT_GET(DT_NODELABEL(uart0));
 
+//! Bytes received by the UART interrupt, waiting to be parsed
+RING_BUF_DECLARE(rx_ring, CONFIG_APP_SHUTDOWN_RX_BUFFER_SIZE);
+
+//! Signalled by the UART interrupt whenever there is something in the ring buffer
+K_SEM_DEFINE(rx_ready, 0, 1);
+
+//! Interrupt-driven reception is available
+bool irq_enabled = false;
+
+//! Number of times the power had to be cut since the last shutdown request (saturating)
+std::uint16_t forced_cutoffs = 0;
+
+//! Consecutive forced power cutoffs
+unsigned overruns = 0;
+
+//! Local time at uptime 0 (in seconds since midnight), once the main board has told us the time
+std::optional<std::int64_t> clock_offset;
+
+//! No wake-ups between these times (minutes since midnight), as last requested by the main board
+std::uint16_t quiet_start = 0;
+std::uint16_t quiet_end = 0;
+
 namespace uart {
 
+void on_interrupt(const device *dev, void *user_data) {
+   ARG_UNUSED(user_data);
+
+   if (!uart_irq_update(dev) || !uart_irq_rx_ready(dev)) {
+      return;
+   }
+
+   std::array<std::uint8_t, 8> buffer;
+   int len;
+   while ((len = uart_fifo_read(dev, buffer.data(), buffer.size())) > 0) {
+      // Nothing to be done about an overflow here: the request is going to fail the checksum and is repeated
+      (void)ring_buf_put(&rx_ring, buffer.data(), len);
+   }
+
+   k_sem_give(&rx_ready);
+}
+
 void suspend() {
    LOG_DBG("Suspending shutdown UART");
 
@@ -55,6 +98,12 @@ int init_uart(void) {
       return -ENODEV;
    }
 
+   if (const int err = uart_irq_callback_user_data_set(uart_dev, uart::on_interrupt, nullptr); err < 0) {
+      LOG_ERR("Error setting the shutdown UART callback: %d", err);
+   } else {
+      irq_enabled = true;
+   }
+
    uart::suspend();
    return 0;
 }
@@ -63,16 +112,31 @@ int init_uart(void) {
 
 class shutdown_request {
 public:
+   enum class kind : std::uint8_t {
+      //! Cut the power for the duration, payload: duration (u16 seconds)
+      shutdown = 0xAD,
+
+      //! Only acknowledge the request and start the awake budget over, payload: ignored (u16)
+      status = 0xAF,
+
+      //! Cut the power for the duration, but keep the quiet hours. Payload: duration (u32 seconds), current time of
+      //! day (u32 seconds since midnight, 0xFFFFFFFF - unknown), quiet hours start and end (u16 minutes since midnight
+      //! each, start == end - no quiet hours)
+      scheduled_shutdown = 0xB1,
+   };
+
    enum class state {
       first_magic,
       second_magic,
-      low_duration,
-      high_duration,
+      payload,
       low_crc,
       high_crc,
       done,
    };
 
+   //! Time of day value for "unknown"
+   static constexpr std::uint32_t unknown_time = 0xFFFFFFFF;
+
 public:
    state add_byte(std::uint8_t byte) {
       switch (state_) {
@@ -80,10 +144,8 @@ public:
             return on_first_magic(byte);
          case state::second_magic:
             return on_second_magic(byte);
-         case state::low_duration:
-            return on_low_duration(byte);
-         case state::high_duration:
-            return on_high_duration(byte);
+         case state::payload:
+            return on_payload(byte);
          case state::low_crc:
             return on_low_crc(byte);
          case state::high_crc:
@@ -95,18 +157,61 @@ public:
       }
    }
 
-   std::chrono::seconds sleep_duration() {
-      if (state_ != state::done) {
-         throw std::runtime_error("Invalid state");
+   kind type() const { return kind_; }
+
+   std::chrono::seconds sleep_duration() const {
+      check_done();
+
+      if (kind_ == kind::scheduled_shutdown) {
+         return std::chrono::seconds{read_u32(0)};
+      }
+      return std::chrono::seconds{read_u16(0)};
+   }
+
+   std::optional<std::uint32_t> time_of_day() const {
+      check_done();
+
+      if (kind_ != kind::scheduled_shutdown || read_u32(4) == unknown_time) {
+         return std::nullopt;
       }
+      return read_u32(4);
+   }
+
+   //! @return Quiet hours start and end (0, 0 if there are none)
+   std::pair<std::uint16_t, std::uint16_t> quiet_hours() const {
+      check_done();
+
+      if (kind_ != kind::scheduled_shutdown) {
+         return {0, 0};
+      }
+      return {read_u16(8), read_u16(10)};
+   }
 
-      const auto seconds = to_uint16_t(low_duration_, high_duration_);
-      return std::chrono::seconds{seconds};
+   //! Let the main board know that the request has arrived:
+   //! 2 bytes magic number + 2 bytes number of forced power cutoffs + CRC of the request
+   void acknowledge(std::uint16_t cutoffs) {
+      check_done();
+
+      const std::array<std::uint8_t, 6> payload{
+         0xAC,
+         0xCE,
+         static_cast<std::uint8_t>(cutoffs & 0xFF),
+         static_cast<std::uint8_t>((cutoffs >> 8) & 0xFF),
+         low_crc_,
+         high_crc_,
+      };
+      for (const auto byte : payload) {
+         uart_poll_out(uart_dev, byte);
+      }
    }
 
+   //! Start waiting for the next request
+   void reset() { state_ = state::first_magic; }
+
 private:
    state on_first_magic(std::uint8_t byte) {
       if (byte == 0xDE) {
+         frame_[0] = byte;
          state_ = state::second_magic;
       } else {
          log_bad_byte(byte);
@@ -115,23 +220,31 @@ private:
    }
 
    state on_second_magic(std::uint8_t byte) {
-      if (byte == 0xAD) {
-         state_ = state::low_duration;
-      } else {
-         log_bad_byte(byte);
+      switch (static_cast<kind>(byte)) {
+         case kind::shutdown:
+         case kind::status:
+            payload_size_ = 2;
+            break;
+         case kind::scheduled_shutdown:
+            payload_size_ = 12;
+            break;
+         default:
+            log_bad_byte(byte);
+            return state_;
       }
-      return state_;
-   }
 
-   state on_low_duration(std::uint8_t byte) {
-      low_duration_ = byte;
-      state_ = state::high_duration;
+      kind_ = static_cast<kind>(byte);
+      frame_[1] = byte;
+      received_ = 0;
+      state_ = state::payload;
       return state_;
    }
 
-   state on_high_duration(std::uint8_t byte) {
-      high_duration_ = byte;
-      state_ = state::low_crc;
+   state on_payload(std::uint8_t byte) {
+      frame_[2 + received_++] = byte;
+      if (received_ == payload_size_) {
+         state_ = state::low_crc;
+      }
       return state_;
    }
 
@@ -144,10 +257,10 @@ private:
    state on_high_crc(std::uint8_t byte) {
       high_crc_ = byte;
 
-      const std::array<std::uint8_t, 4> payload{0xDE, 0xAD, low_duration_, high_duration_};
       const auto received_crc = to_uint16_t(low_crc_, high_crc_);
 
-      const auto crc_value = crc16_ansi(payload.data(), payload.size());
+      // 2 bytes magic number + payload
+      const auto crc_value = crc16_ansi(frame_.data(), 2 + payload_size_);
       if (received_crc != crc_value) {
          LOG_WRN("Checksum mismatch: %" PRIu16 " vs %" PRIu16, received_crc, crc_value);
          state_ = state::first_magic;
@@ -175,7 +288,22 @@ private:
       state_ = state::first_magic;
    }
 
-   std::uint16_t to_uint16_t(std::uint8_t low, std::uint16_t high) {
+   void check_done() const {
+      if (state_ != state::done) {
+         throw std::runtime_error("Invalid state");
+      }
+   }
+
+   //! Little-endian payload values
+   std::uint16_t read_u16(std::size_t offset) const {
+      return to_uint16_t(frame_[2 + offset], frame_[2 + offset + 1]);
+   }
+
+   std::uint32_t read_u32(std::size_t offset) const {
+      return read_u16(offset) | (static_cast<std::uint32_t>(read_u16(offset + 2)) << 16);
+   }
+
+   static std::uint16_t to_uint16_t(std::uint8_t low, std::uint16_t high) {
       return static_cast<std::uint16_t>((high << 8) | low);
    }
 
@@ -185,10 +313,8 @@ private:
             return "frist_magic";
          case state::second_magic:
             return "second_magic";
-         case state::low_duration:
-            return "low_duration";
-         case state::high_duration:
-            return "high_duration";
+         case state::payload:
+            return "payload";
          case state::low_crc:
             return "low_crc";
          case state::high_crc:
@@ -202,50 +328,149 @@ private:
 
 private:
    state state_{state::first_magic};
+   kind kind_{kind::shutdown};
 
-   std::uint8_t low_duration_{};
-   std::uint8_t high_duration_{};
+   //! Magic number followed by the payload
+   std::array<std::uint8_t, 2 + 12> frame_{};
+   std::size_t payload_size_{0};
+   std::size_t received_{0};
 
    std::uint8_t low_crc_{};
    std::uint8_t high_crc_{};
 };
 
+constexpr std::int64_t seconds_per_day = 24 * 60 * 60;
+constexpr std::uint16_t minutes_per_day = 24 * 60;
+
+std::int64_t uptime_seconds() {
+   return k_uptime_get() / 1000;
+}
+
+std::int64_t time_of_day(std::int64_t seconds) {
+   return ((seconds % seconds_per_day) + seconds_per_day) % seconds_per_day;
+}
+
+//! Keep the clock and the quiet hours sent along with the shutdown request
+void update_schedule(const shutdown_request &req) {
+   if (const auto now = req.time_of_day(); now && *now < seconds_per_day) {
+      clock_offset = static_cast<std::int64_t>(*now) - uptime_seconds();
+   }
+
+   const auto [start, end] = req.quiet_hours();
+   if (start >= minutes_per_day || end >= minutes_per_day) {
+      LOG_WRN("Bad quiet hours: %d - %d", static_cast<int>(start), static_cast<int>(end));
+      return;
+   }
+
+   quiet_start = start;
+   quiet_end = end;
+}
+
+//! Move the wake-up out of the quiet hours (only possible once the main board has told us the time)
+std::chrono::seconds apply_schedule(std::chrono::seconds duration) {
+   if (!clock_offset || quiet_start == quiet_end) {
+      return duration;
+   }
+
+   const auto wake_up = time_of_day(*clock_offset + uptime_seconds() + duration.count());
+   const std::int64_t start = quiet_start * 60;
+   const std::int64_t end = quiet_end * 60;
+
+   // Quiet hours might span midnight (e.g. 23:00 - 06:00)
+   const bool is_quiet = (start < end) ? (wake_up >= start && wake_up < end) : (wake_up >= start || wake_up < end);
+   if (!is_quiet) {
+      return duration;
+   }
+
+   const auto delay = time_of_day(end - wake_up);
+   LOG_DBG("Wake-up delayed by %d seconds (quiet hours)", static_cast<int>(delay));
+   return duration + std::chrono::seconds{delay};
+}
+
+//! The main board has exceeded the awake budget (e.g. it got stuck), back off while it keeps happening
+std::chrono::seconds forced_cutoff() {
+   if (forced_cutoffs < UINT16_MAX) {
+      ++forced_cutoffs;
+   }
+
+   // Limit the shift, the interval is capped long before that anyway
+   overruns = std::min(overruns + 1, 16U);
+
+   const auto interval = std::min(static_cast<std::int64_t>(CONFIG_APP_WAKE_UP_INTERVAL) << (overruns - 1),
+                                  static_cast<std::int64_t>(CONFIG_APP_MAX_WAKE_UP_INTERVAL));
+
+   LOG_WRN("Awake budget exceeded (%u times in a row), sleeping for %d seconds", overruns, static_cast<int>(interval));
+   return apply_schedule(std::chrono::seconds{interval});
+}
+
 } // namespace
 
 std::chrono::seconds power_ic::shutdown::get_sleep_duration() {
+   constexpr std::int64_t awake_budget_ms = static_cast<std::int64_t>(CONFIG_APP_AWAKE_BUDGET) * 1000;
+   auto deadline = k_uptime_get() + awake_budget_ms;
+
    // While booting up, the ESP32 shortly toggles the UART pin, skip this by sleeping half a second
    k_sleep(K_MSEC(500));
 
    uart::resume();
 
+   if (!irq_enabled) {
+      uart::suspend();
+
+      // At least let the ESP32 chip update the image (and return the default sleep interval)
+      k_sleep(K_SECONDS(20));
+      return std::chrono::seconds{CONFIG_APP_WAKE_UP_INTERVAL};
+   }
+
+   ring_buf_reset(&rx_ring);
+   k_sem_reset(&rx_ready);
+   uart_irq_rx_enable(uart_dev);
+
    shutdown_request req;
    std::chrono::seconds result{};
 
-   while (true) {
-      std::uint8_t received;
-      const auto res = uart_poll_in(uart_dev, &received);
-      if (res == 0) {
-         // Got a byte
-         auto state = req.add_byte(received);
-         if (state == shutdown_request::state::done) {
-            result = req.sleep_duration();
+   // Sleeping on the semaphore lets the idle thread keep the chip in its low power state between the bytes
+   bool done = false;
+   while (!done) {
+      const auto remaining = deadline - k_uptime_get();
+      if (remaining <= 0 || k_sem_take(&rx_ready, K_MSEC(remaining)) != 0) {
+         result = forced_cutoff();
+         break;
+      }
+
+      std::array<std::uint8_t, 8> buffer;
+      std::uint32_t len;
+      while (!done && (len = ring_buf_get(&rx_ring, buffer.data(), buffer.size())) > 0) {
+         for (std::uint32_t i = 0; i < len; ++i) {
+            auto state = req.add_byte(buffer[i]);
+            if (state != shutdown_request::state::done) {
+               continue;
+            }
+
+            req.acknowledge(forced_cutoffs);
+            if (req.type() == shutdown_request::kind::status) {
+               // The main board is alive and wants to stay that way (e.g. while it is being configured)
+               deadline = k_uptime_get() + awake_budget_ms;
+               req.reset();
+               continue;
+            }
+
+            // A plain shutdown request drops the schedule
+            update_schedule(req);
+
+            result = apply_schedule(req.sleep_duration());
             LOG_DBG("Received sleep request: %d seconds", static_cast<int>(result.count()));
+
+            // The count has been reported with the acknowledgement, and the main board is fine again
+            forced_cutoffs = 0;
+            overruns = 0;
+            done = true;
             break;
          }
-      } else if (res == -1) {
-         // No character was available to read.
-         k_sleep(K_MSEC(100));
-         continue;
-      } else {
-         LOG_ERR("UART error: %d", res);
-
-         // At least let the ESP32 chpip update the image (and return the default sleep interval)
-         k_sleep(K_SECONDS(20));
-         result = std::chrono::seconds{CONFIG_APP_WAKE_UP_INTERVAL};
-         break;
       }
    }
 
+   uart_irq_rx_disable(uart_dev);
    uart::suspend();
 
    return result;
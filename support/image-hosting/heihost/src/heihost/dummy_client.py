@@ -8,66 +8,207 @@ import lz4.block
 from PIL import Image
 
 
-def download_and_save(host: str, port: int):
-    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-    sock.connect((host, port))
-
-    # Get image request
-    sock.send(struct.pack('<BBIIBI', 0x10, 1, 55, 0, 10, 3300000))
-
-    # Receive the size of the image
-    header_data = sock.recv(8)
-    header = struct.unpack('<BBHHH', header_data)
-
-    message_type = header[0]
-    update_type = header[1]
-    width = header[2]
-    height = header[3]
-    num_blocks = header[4]
-    print(f't={message_type}, u={update_type}, w={width}, h={height}, n={num_blocks}')
-
+def read_blocks(sock: socket.socket, num_blocks: int):
     total_received = 0
     image_data = b''
+    previous = None
     for i in range(num_blocks):
         block_header = sock.recv(5)
         total_received += len(block_header)
 
         block_header_data = struct.unpack('<BHH', block_header)
         message_type = block_header_data[0]
-        if message_type != 0x12:
+        if message_type == 0x17:
+            fill_size, fill_word = block_header_data[1], block_header_data[2]
+            print(f'Block #{i:03} r={fill_size}, fill={fill_word:04x}')
+            image_data += struct.pack('<H', fill_word) * (fill_size // 2)
+
+            # There is nothing to use as the dictionary after a fill block
+            previous = None
+            continue
+
+        if message_type not in (0x12, 0x16):
             raise ConnectionError(f"Bad block message {message_type}")
 
+        linked = message_type == 0x16
+        if linked and previous is None:
+            raise ConnectionError("Linked block without a previous block")
+
         uncompressed_size = block_header_data[1]
         compressed_size = block_header_data[2]
-        print(f'Block #{i:03} r={uncompressed_size}, c={compressed_size}')
+        print(f'Block #{i:03} r={uncompressed_size}, c={compressed_size}, l={linked}')
 
-        chunk = sock.recv(compressed_size)
+        chunk = sock.recv(compressed_size, socket.MSG_WAITALL)
         if not chunk:
             raise ConnectionError("Socket connection broken")
 
         total_received += len(chunk)
 
-        decompressed = lz4.block.decompress(chunk, uncompressed_size=uncompressed_size)
+        if linked:
+            decompressed = lz4.block.decompress(chunk, uncompressed_size=uncompressed_size, dict=previous)
+        else:
+            decompressed = lz4.block.decompress(chunk, uncompressed_size=uncompressed_size)
+
         if len(decompressed) != uncompressed_size:
             raise ConnectionError(f"Bad image data: {len(decompressed)} vs {uncompressed_size}")
 
         image_data += decompressed
+        previous = decompressed
+
+    return image_data, total_received
+
+
+def read_delta(sock: socket.socket, previous: Image):
+    header = struct.unpack('<BHI', sock.recv(7))
+    update_type, num_areas, fingerprint = header
+    print(f'u={update_type}, n={num_areas}, f={fingerprint:08x}')
+
+    image = previous.copy()
+    total_received = 0
+    for i in range(num_areas):
+        message_type, x, y, width, height, num_blocks = struct.unpack('<BHHHHH', sock.recv(11))
+        if message_type != 0x15:
+            raise ConnectionError(f"Bad area message {message_type}")
+
+        print(f'Area #{i:02} x={x}, y={y}, w={width}, h={height}, n={num_blocks}')
+        area_data, received = read_blocks(sock, num_blocks)
+        total_received += received
+
+        # Areas are in pixels, our image holds two pixels per byte
+        image.paste(Image.frombytes('L', (width // 2, height), area_data), (x // 2, y))
+
+    print(f'Total received: {total_received}')
+    return image
+
+
+def read_tiled(sock: socket.socket, slots: int):
+    update_type, width, height, tile_width, tile_height, fingerprint = struct.unpack('<BHHBBI', sock.recv(11))
+    print(f'u={update_type}, w={width}, h={height}, t={tile_width}x{tile_height}, f={fingerprint:08x}')
+
+    # Tile width is in pixels, two pixels per byte
+    tile_row_bytes = tile_width // 2
+    tile_bytes = tile_row_bytes * tile_height
+    columns = -(-width // tile_row_bytes)
+
+    cache = [bytes(tile_bytes)] * slots
+    image_data = b''
+    total_received = 0
+    for y in range(0, height, tile_height):
+        message_type, num_new_tiles, num_blocks = struct.unpack('<BHH', sock.recv(5))
+        if message_type != 0x1B:
+            raise ConnectionError(f"Bad band message {message_type}")
+
+        new_slots = sock.recv(num_new_tiles, socket.MSG_WAITALL) if num_new_tiles else b''
+        tile_data, received = read_blocks(sock, num_blocks)
+        if len(tile_data) != num_new_tiles * tile_bytes:
+            raise ConnectionError(f"Bad tile data: {len(tile_data)} vs {num_new_tiles}")
+
+        for i, slot in enumerate(new_slots):
+            cache[slot] = tile_data[i * tile_bytes:(i + 1) * tile_bytes]
+
+        tile_map = sock.recv(columns, socket.MSG_WAITALL)
+        total_received += 5 + num_new_tiles + received + columns
+
+        for row in range(min(tile_height, height - y)):
+            line = b''.join(cache[slot][row * tile_row_bytes:(row + 1) * tile_row_bytes] for slot in tile_map)
+            image_data += line[:width]
+
+    print(f'Total received: {total_received}')
+    return Image.frombytes('L', (width, height), image_data)
+
+
+def send_request(sock: socket.socket, fingerprint: int, codecs: int, legacy: bool, slots: int):
+    if legacy:
+        sock.send(struct.pack('<BBIIBI', 0x10, 1, 55, 0, 10, 3300000))
+        return
+
+    # codecs, pixel formats: 4bpp, max block size: 4096, features: not modified + delta updates (+ tiled frames)
+    features = 0x03 | (0x04 if slots else 0)
+    payload = struct.pack('<BIIBIIBBHIHH', 1, 55, 0, 10, 3300000, fingerprint, codecs, 0x04, 4096, features, slots, 0)
+    sock.send(struct.pack('<BBH', 0x18, 2, len(payload)) + payload)
+
+    message_type = struct.unpack('<B', sock.recv(1))[0]
+    if message_type != 0x19:
+        raise ConnectionError(f"Bad session message {message_type}")
+
+    version, payload_size = struct.unpack('<BH', sock.recv(3))
+    payload = sock.recv(payload_size, socket.MSG_WAITALL)
+    codecs, pixel_format, block_size, features = struct.unpack('<BBHI', payload[:8])
+    print(f'v={version}, c={codecs:02x}, pf={pixel_format}, bs={block_size}, f={features:08x}')
+    if payload_size >= 16:
+        time_of_day, next_wake = struct.unpack('<II', payload[8:16])
+        print(f'time of day={time_of_day}, next wake={next_wake}')
+
+
+def download_and_save(host: str, port: int, fingerprint: int, previous: Image, codecs: int, legacy: bool,
+                      slots: int):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.connect((host, port))
+
+    # Get image request
+    send_request(sock, fingerprint, codecs, legacy, slots)
+
+    message_type = struct.unpack('<B', sock.recv(1))[0]
+    if message_type == 0x13:
+        print('Image not modified')
+        sock.close()
+        return None
+
+    if message_type == 0x14:
+        if previous is None:
+            raise ConnectionError("Received a delta without a previous image")
+        image = read_delta(sock, previous)
+        sock.close()
+        return image
+
+    if message_type == 0x1A:
+        image = read_tiled(sock, slots)
+        sock.close()
+        return image
+
+    if message_type != 0x11:
+        raise ConnectionError(f"Bad response message {message_type}")
+
+    # Receive the size of the image, the legacy header has no fingerprint
+    if legacy:
+        update_type, width, height, num_blocks = struct.unpack('<BHHH', sock.recv(7))
+        fingerprint = 0
+    else:
+        update_type, width, height, num_blocks, fingerprint = struct.unpack('<BHHHI', sock.recv(11))
+
+    print(f't={message_type}, u={update_type}, w={width}, h={height}, n={num_blocks}, f={fingerprint:08x}')
+
+    image_data, total_received = read_blocks(sock, num_blocks)
 
     sock.close()
 
     print(f'Total received: {total_received}')
-    return image_data, width, height
+    return Image.frombytes('L', (width, height), image_data)
 
 
 def main():
     parser = argparse.ArgumentParser('Dummy image server client')
     parser.add_argument('--host', type=str, required=True, help='Image server host')
     parser.add_argument('--port', type=int, required=True, help='Image server port')
+    parser.add_argument('--fingerprint', type=lambda x: int(x, 0), default=0,
+                        help='Fingerprint of the currently shown image')
+    parser.add_argument('--previous', type=str, help='Previously received image, required for delta updates')
+    parser.add_argument('--independent-blocks', action='store_true',
+                        help='Don\'t ask for blocks compressed with the previous block as the dictionary')
+    parser.add_argument('--no-fill-blocks', action='store_true', help='Don\'t ask for fill blocks')
+    parser.add_argument('--legacy', action='store_true', help='Use the legacy (version 1) request')
+    parser.add_argument('--tile-slots', type=int, default=128,
+                        help='Number of cached tiles for the tiled frames (0 disables them)')
 
     args = parser.parse_args()
 
-    image_data, width, height = download_and_save(args.host, args.port)
-    image = Image.frombytes('L', (width, height), image_data)
+    previous = Image.open(args.previous) if args.previous else None
+    codecs = (0 if args.independent_blocks else 0x01) | (0 if args.no_fill_blocks else 0x02)
+    image = download_and_save(args.host, args.port, args.fingerprint, previous, codecs, args.legacy,
+                              args.tile_slots)
+    if image is None:
+        return
+
     image.save('image.png')
 
 
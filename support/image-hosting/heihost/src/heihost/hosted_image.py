@@ -1,4 +1,8 @@
 import asyncio
+import zlib
+from collections import OrderedDict
+from dataclasses import dataclass
+from typing import Optional
 
 from PIL import Image
 import numpy as np
@@ -7,7 +11,34 @@ import lz4.block
 from heihost.log import Log
 
 
-class HostedImage:
+class BlockSource:
+    """
+    Raw pixel data, compressed into blocks on demand.
+    Every encoding is only compressed once, and kept around afterward.
+    """
+
+    def __init__(self, raw_data: np.ndarray):
+        self.raw_data = raw_data
+        self._blocks = {}  # type: dict[HostedImage.Encoding, list[HostedImage.Block]]
+
+    def blocks_for(self, encoding: 'HostedImage.Encoding') -> list['HostedImage.Block']:
+        blocks = self._blocks.get(encoding)
+        if blocks is None:
+            blocks = HostedImage.compress_blocks(self.raw_data, encoding)
+            self._blocks[encoding] = blocks
+        return blocks
+
+    async def encode(self, encoding: 'HostedImage.Encoding') -> list['HostedImage.Block']:
+        if encoding in self._blocks:
+            return self._blocks[encoding]
+        return await asyncio.to_thread(self.blocks_for, encoding)
+
+    @property
+    def blocks(self) -> list['HostedImage.Block']:
+        return self.blocks_for(HostedImage.Encoding())
+
+
+class HostedImage(BlockSource):
     """
     A grayscale image split into blocks for easier delivery.
     Each block is also compressed with LZ4.
@@ -16,26 +47,83 @@ class HostedImage:
     class Block:
         SIZE = 4096
 
-        def __init__(self, uncompressed_size: int, data: bytes):
+        # Fill blocks are limited by the size field only
+        MAX_FILL_SIZE = 0xFFFE
+
+        # Shorter runs are not worth splitting the LZ4 blocks (and resetting the linked block dictionary)
+        MIN_FILL_SIZE = 256
+
+        def __init__(self, uncompressed_size: int, data: bytes, linked: bool = False, fill_word: int = None):
             self.uncompressed_size = uncompressed_size
             self.data = data
             self.size = len(self.data)
+            self.linked = linked
+            self.fill_word = fill_word
+
+        @property
+        def is_fill(self) -> bool:
+            return self.fill_word is not None
+
+    @dataclass(frozen=True)
+    class Encoding:
+        # Compress every block but the first one using the previous block as the dictionary
+        linked: bool = False
 
-    def __init__(self, width: int, height: int, blocks: list['HostedImage.Block'], image: Image):
+        # Maximal uncompressed size of a single block (Block.SIZE)
+        block_size: int = 4096
+
+        # Send runs of a repeated 16-bit word as fill blocks
+        fill: bool = False
+
+    class Area(BlockSource):
+        """
+        A rectangular part of the image (in pixels) together with its blocks.
+        """
+
+        def __init__(self, x: int, y: int, width: int, height: int, raw_data: np.ndarray):
+            super().__init__(raw_data)
+            self.x = x
+            self.y = y
+            self.width = width
+            self.height = height
+
+    def __init__(self, width: int, height: int, image: Image):
+        super().__init__(np.array(image).flatten())
         self.width = width
         self.height = height
-        self.blocks = blocks
         self.image = image
+        self.fingerprint = HostedImage._fingerprint(image)
+        self._tiled_frames = {}  # type: dict[tuple[int, int], Optional[TiledFrame]]
 
-        original_size = sum(x.uncompressed_size for x in self.blocks)
+        original_size = len(self.raw_data)
         compressed_size = sum(x.size for x in self.blocks)
         Log.debug(f'Hosted image: {compressed_size} / {original_size} ({100 / original_size * compressed_size:0.2f}%)')
 
+    def tiled_frame(self, slots: int, block_size: int) -> Optional['TiledFrame']:
+        key = (slots, block_size)
+        if key not in self._tiled_frames:
+            self._tiled_frames[key] = TiledFrame.build(self, slots, block_size)
+        return self._tiled_frames[key]
+
+    async def encode_tiled(self, slots: int, block_size: int) -> Optional['TiledFrame']:
+        if (slots, block_size) in self._tiled_frames:
+            return self._tiled_frames[(slots, block_size)]
+        return await asyncio.to_thread(self.tiled_frame, slots, block_size)
+
     @staticmethod
     async def from_image(image: Image):
         grayscale = await asyncio.to_thread(HostedImage._convert_to_4bit_grayscale, image)
-        width, height, blocks = await asyncio.to_thread(HostedImage._split_into_blocks, grayscale)
-        return HostedImage(width, height, blocks, grayscale)
+        width, height = grayscale.size
+        return await asyncio.to_thread(HostedImage, width, height, grayscale)
+
+    @staticmethod
+    def _fingerprint(image: Image) -> int:
+        """
+        Fingerprint of the encoded image data, sent to the clients together with the image.
+        The clients send it back with the next request, so that we can skip sending the same image once again.
+        Zero is reserved for "no image".
+        """
+        return zlib.crc32(image.tobytes()) or 1
 
     @staticmethod
     def _convert_to_4bit_grayscale(image: Image):
@@ -87,25 +175,298 @@ class HostedImage:
         return Image.fromarray(combined.astype(np.uint8), mode='L')
 
     @staticmethod
-    def _split_into_blocks(image: Image):
-        raw = image.convert('L')
-        width, height = raw.size
-        pixel_data = np.array(raw)
-        raw_data = pixel_data.flatten()
+    def compress_blocks(raw_data: np.ndarray, encoding: 'HostedImage.Encoding') -> list['HostedImage.Block']:
+        """
+        Linked blocks: the device decompresses the blocks in order and still has the previous block around, so repeated
+        rows and widgets across the block boundaries don't have to be sent again.
+        Fill blocks reset the dictionary, as there is no pixel data on the device side to use.
+        """
+        blocks = []
+        start = 0
+        runs = HostedImage._find_fill_runs(raw_data) if encoding.fill else []
+        for run_start, run_end, word in runs:
+            blocks += HostedImage._compress_segment(raw_data[start:run_start], encoding)
 
+            remaining = run_end - run_start
+            while remaining != 0:
+                size = min(remaining, HostedImage.Block.MAX_FILL_SIZE)
+                blocks.append(HostedImage.Block(size, b'', fill_word=word))
+                remaining -= size
+
+            start = run_end
+
+        blocks += HostedImage._compress_segment(raw_data[start:], encoding)
+        return blocks
+
+    @staticmethod
+    def _find_fill_runs(raw_data: np.ndarray) -> list[tuple[int, int, int]]:
+        """
+        :return: (start, end, word) of every run of a repeated 16-bit word, in bytes
+        """
+        if len(raw_data) % 2 != 0:
+            # Pixel data is transferred in words, this should never happen
+            return []
+
+        words = raw_data.view('<u2')
+        changes = np.flatnonzero(np.diff(words)) + 1
+        starts = np.concatenate(([0], changes))
+        ends = np.concatenate((changes, [len(words)]))
+
+        long_enough = (ends - starts) * 2 >= HostedImage.Block.MIN_FILL_SIZE
+        return [(int(s) * 2, int(e) * 2, int(words[s])) for s, e in zip(starts[long_enough], ends[long_enough])]
+
+    @staticmethod
+    def _compress_segment(raw_data: np.ndarray, encoding: 'HostedImage.Encoding') -> list['HostedImage.Block']:
         remaining = len(raw_data)
         start = 0
 
         blocks = []
+        previous = None
         while remaining != 0:
-            size = min(HostedImage.Block.SIZE, remaining)
-            block_data = raw_data[start:start + size]
+            size = min(encoding.block_size, remaining)
+            block_data = raw_data[start:start + size].tobytes()
             assert (len(block_data) == size)
 
             remaining -= size
             start += size
-            compressed_data = lz4.block.compress(block_data, store_size=False)
+            if previous is None:
+                compressed_data = lz4.block.compress(block_data, store_size=False)
+            else:
+                compressed_data = lz4.block.compress(block_data, store_size=False, dict=previous)
+
+            blocks.append(HostedImage.Block(len(block_data), compressed_data, previous is not None))
+            if encoding.linked:
+                previous = block_data
+
+        return blocks
+
+
+class TiledFrame:
+    """
+    The image split into tiles, with every unique tile only sent once.
+    The image is sent in bands (rows of tiles). The client keeps a limited number of tiles around (the slots), so we
+    simulate its cache here: every band tells which new tiles go into which slots, followed by the tile data and the
+    slot of every tile in the band.
+    """
+
+    # Tile size in pixels, the width is a multiple of 4 pixels (one 16-bit word of 4bpp data)
+    TILE_WIDTH = 16
+    TILE_HEIGHT = 16
+
+    # 4bpp, two pixels per byte
+    TILE_ROW_BYTES = TILE_WIDTH // 2
+    TILE_BYTES = TILE_ROW_BYTES * TILE_HEIGHT
+
+    # Slot indices are sent as a single byte
+    MAX_SLOTS = 255
+
+    class Band:
+        def __init__(self, new_slots: list[int], blocks: list[HostedImage.Block], tile_map: list[int]):
+            self.new_slots = new_slots
+            self.blocks = blocks
+            self.tile_map = tile_map
+
+        @property
+        def size(self) -> int:
+            # Band header, new slots, block headers and data, tile map
+            return 1 + 2 + 2 + len(self.new_slots) + sum(1 + 2 + 2 + x.size for x in self.blocks) + len(self.tile_map)
+
+    def __init__(self, bands: list['TiledFrame.Band'], unique_tiles: int):
+        self.bands = bands
+
+        Log.debug(f'Tiled frame: {unique_tiles} unique tiles, {self.size} bytes')
+
+    @property
+    def size(self) -> int:
+        return sum(x.size for x in self.bands)
+
+    @staticmethod
+    def build(image: HostedImage, slots: int, block_size: int) -> Optional['TiledFrame']:
+        """
+        :return: The tiled frame, or None if a single band needs more tiles than the client can cache.
+        """
+        slots = min(slots, TiledFrame.MAX_SLOTS)
+        data = np.array(image.image)
+        height, width = data.shape
+
+        rows = -(-height // TiledFrame.TILE_HEIGHT)
+        cols = -(-width // TiledFrame.TILE_ROW_BYTES)
+        padded = np.zeros((rows * TiledFrame.TILE_HEIGHT, cols * TiledFrame.TILE_ROW_BYTES), dtype=np.uint8)
+        padded[:height, :width] = data
+        tiles = padded.reshape(rows, TiledFrame.TILE_HEIGHT, cols, TiledFrame.TILE_ROW_BYTES).swapaxes(1, 2)
+
+        tiles_per_block = max(block_size // TiledFrame.TILE_BYTES, 1)
+
+        cache = OrderedDict()  # type: OrderedDict[bytes, int]
+        unique_tiles = set()
+        bands = []
+        for row in range(rows):
+            band_tiles = [tiles[row, col].tobytes() for col in range(cols)]
+            needed = set(band_tiles)
+            if len(needed) > slots:
+                return None
+
+            new_slots = []
+            new_data = []
+            for tile in band_tiles:
+                if tile not in cache:
+                    cache[tile] = TiledFrame._free_slot(cache, needed, slots)
+                    new_slots.append(cache[tile])
+                    new_data.append(tile)
+
+                # Recently used tiles are the last ones to be evicted
+                cache.move_to_end(tile)
+
+            unique_tiles.update(needed)
+            blocks = []
+            for start in range(0, len(new_data), tiles_per_block):
+                block_data = b''.join(new_data[start:start + tiles_per_block])
+                blocks.append(HostedImage.Block(len(block_data), lz4.block.compress(block_data, store_size=False)))
+
+            bands.append(TiledFrame.Band(new_slots, blocks, [cache[x] for x in band_tiles]))
+
+        return TiledFrame(bands, len(unique_tiles))
+
+    @staticmethod
+    def _free_slot(cache: 'OrderedDict[bytes, int]', needed: set[bytes], slots: int) -> int:
+        if len(cache) < slots:
+            return len(cache)
+
+        # Evict the least recently used tile, that is not part of the current band
+        for tile, slot in cache.items():
+            if tile not in needed:
+                del cache[tile]
+                return slot
+
+        raise RuntimeError('No free tile slots')
+
+
+class ImageDelta:
+    """
+    Areas that have changed between two hosted images.
+    The changes are detected on a grid of cells, neighbouring changed cells are combined into rectangular areas.
+    """
+
+    # Cell size in pixels, the width has to be a multiple of 4 pixels (one 16-bit word of 4bpp data)
+    CELL_WIDTH = 16
+    CELL_HEIGHT = 16
+
+    # Maximal number of areas in a single delta, has to match APP_IMAGE_CLIENT_MAX_DELTA_AREAS on the device side
+    MAX_AREAS = 16
+
+    # Send the full image instead, if more than this fraction of the image has changed
+    MAX_CHANGED_RATIO = 0.5
+
+    def __init__(self, areas: list[HostedImage.Area]):
+        self.areas = areas
+
+        original_size = sum(len(area.raw_data) for area in self.areas)
+        Log.debug(f'Image delta: {len(self.areas)} areas, {original_size} bytes')
+
+    @staticmethod
+    async def compute(previous: HostedImage, current: HostedImage) -> Optional['ImageDelta']:
+        """
+        :return: The changes between the two images, or None if sending the full image is the better option.
+        """
+        areas = await asyncio.to_thread(ImageDelta._compute_areas, previous, current)
+        if areas is None:
+            return None
+        return ImageDelta(areas)
+
+    @staticmethod
+    def _compute_areas(previous: HostedImage, current: HostedImage) -> Optional[list[HostedImage.Area]]:
+        old_data = np.array(previous.image)
+        new_data = np.array(current.image)
+        if old_data.shape != new_data.shape:
+            return None
+
+        # Each byte holds two pixels
+        changed = old_data != new_data
+        if not changed.any():
+            return None
+
+        cell_width = ImageDelta.CELL_WIDTH // 2
+        cell_height = ImageDelta.CELL_HEIGHT
+
+        height, width = changed.shape
+        rows = -(-height // cell_height)
+        cols = -(-width // cell_width)
+
+        padded = np.zeros((rows * cell_height, cols * cell_width), dtype=bool)
+        padded[:height, :width] = changed
+        cells = padded.reshape(rows, cell_height, cols, cell_width).any(axis=(1, 3))
+
+        boxes = ImageDelta._merge_overlapping(ImageDelta._find_boxes(cells))
+        if len(boxes) > ImageDelta.MAX_AREAS:
+            boxes = [(min(b[0] for b in boxes), min(b[1] for b in boxes), max(b[2] for b in boxes),
+                      max(b[3] for b in boxes))]
+
+        areas = []
+        changed_pixels = 0
+        for top, left, bottom, right in boxes:
+            y = top * cell_height
+            x = left * cell_width
+            area_height = min(bottom * cell_height, height) - y
+            area_width = min(right * cell_width, width) - x
+            changed_pixels += area_height * area_width * 2
+
+            area_data = new_data[y:y + area_height, x:x + area_width].flatten()
+            areas.append(HostedImage.Area(x * 2, y, area_width * 2, area_height, area_data))
+
+        if changed_pixels > height * width * 2 * ImageDelta.MAX_CHANGED_RATIO:
+            return None
+
+        return areas
+
+    @staticmethod
+    def _find_boxes(cells: np.ndarray) -> list[tuple[int, int, int, int]]:
+        """
+        :return: Bounding boxes (top, left, bottom, right) of the connected groups of changed cells
+        """
+        rows, cols = cells.shape
+        visited = np.zeros_like(cells)
+        boxes = []
+        for row, col in zip(*np.nonzero(cells)):
+            if visited[row, col]:
+                continue
+
+            visited[row, col] = True
+            top, left, bottom, right = row, col, row + 1, col + 1
+            pending = [(row, col)]
+            while pending:
+                r, c = pending.pop()
+                top, left, bottom, right = min(top, r), min(left, c), max(bottom, r + 1), max(right, c + 1)
+                for nr in range(max(r - 1, 0), min(r + 2, rows)):
+                    for nc in range(max(c - 1, 0), min(c + 2, cols)):
+                        if cells[nr, nc] and not visited[nr, nc]:
+                            visited[nr, nc] = True
+                            pending.append((nr, nc))
+
+            boxes.append((int(top), int(left), int(bottom), int(right)))
+
+        return boxes
+
+    @staticmethod
+    def _merge_overlapping(boxes: list[tuple[int, int, int, int]]) -> list[tuple[int, int, int, int]]:
+        """
+        Bounding boxes of different groups might still overlap, combine them until all the boxes are disjoint.
+        """
+
+        def overlap(a, b):
+            return a[0] < b[2] and b[0] < a[2] and a[1] < b[3] and b[1] < a[3]
 
-            blocks.append(HostedImage.Block(len(block_data), compressed_data))
+        merged = True
+        while merged:
+            merged = False
+            for i in range(len(boxes)):
+                for j in range(i + 1, len(boxes)):
+                    if overlap(boxes[i], boxes[j]):
+                        a, b = boxes[i], boxes[j]
+                        boxes[i] = (min(a[0], b[0]), min(a[1], b[1]), max(a[2], b[2]), max(a[3], b[3]))
+                        del boxes[j]
+                        merged = True
+                        break
+                if merged:
+                    break
 
-        return width, height, blocks
+        return boxes
@@ -4,6 +4,8 @@ import json
 import io
 import os
 
+from typing import Awaitable, Callable
+
 from selenium import webdriver
 from selenium.webdriver.firefox.options import Options
 from selenium.webdriver.support import expected_conditions
@@ -79,12 +81,29 @@ class ImageCapture:
         self.latest_screenshot = None
         self.total_screenshots = 0
 
+        # Incremented every time the latest screenshot changes
+        self.generation = 0
+        self.listeners = []  # type: list[Callable[[], Awaitable[None]]]
+
         self.firefox_options = Options()
         self.firefox_options.add_argument("--headless")
         self.firefox_options.set_preference('ui.systemUsesDarkTheme', 0)
 
         self.driver = None
 
+    def add_listener(self, listener: Callable[[], Awaitable[None]]):
+        """
+        :param listener: Called after every new screenshot
+        """
+        self.listeners.append(listener)
+
+    async def _notify_listeners(self):
+        for listener in self.listeners:
+            try:
+                await listener()
+            except Exception as e:
+                Log.error(f'Capture listener failed: {e}')
+
     @property
     def hass_tokens(self):
         return {"hassUrl": self.config.ha_base_url, "access_token": self.config.ha_access_token, "token_type": "Bearer"}
@@ -174,8 +193,10 @@ class ImageCapture:
             image = Image.open(io.BytesIO(screenshot))
 
             self.latest_screenshot = await asyncio.to_thread(image.crop, (0, 0, self.config.width, self.config.height))
+            self.generation += 1
 
             await self._store_current_image()
+            await self._notify_listeners()
 
         except Exception as e:
             Log.error(f'Screen capture failed: {e}')
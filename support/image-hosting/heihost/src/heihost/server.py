@@ -2,28 +2,71 @@ import argparse
 import asyncio
 import struct
 
-from dataclasses import dataclass
-from enum import Enum
+from collections import OrderedDict
+from dataclasses import dataclass, field
+from datetime import datetime, time, timedelta
+from enum import Enum, IntFlag
 
-from typing import Callable, Awaitable, Dict
+from typing import Callable, Awaitable, Dict, Optional
 
 from heihost.log import Log
 from heihost.image_capture import CaptureConfig, ImageCapture
-from heihost.hosted_image import HostedImage
+from heihost.hosted_image import HostedImage, ImageDelta, TiledFrame
 from heihost.encoding import encode, decode, U8, U16, U32
 
 
 class Message:
     class Type(Enum):
+        # Legacy (version 1) request, answered with a full image in the legacy format:
         # fg_valid: u8, runtime_to_empty: u32, runtime_to_full: u32, charge_percentage: u8, voltage: u32
         GetImageRequest = 0x10
 
-        # update_type: u8, width: u16, height: u16, num_blocks: u16
+        # update_type: u8, width: u16, height: u16, num_blocks: u16, fingerprint: u32
+        # The width is in bytes, the legacy response doesn't have the fingerprint.
         ImageHeaderResponse = 0x11
 
         # original_size: u16, compressed_size: u16, compressed_data: u8 * compressed_size
         ImageBlockResponse = 0x12
 
+        # No payload: the client already shows the latest image
+        ImageNotModified = 0x13
+
+        # update_type: u8, num_areas: u16, fingerprint: u32
+        # Followed by num_areas area responses
+        ImageDeltaResponse = 0x14
+
+        # x: u16, y: u16, width: u16, height: u16 (all in pixels), num_blocks: u16
+        # Followed by num_blocks image block responses
+        ImageAreaResponse = 0x15
+
+        # Same as ImageBlockResponse, but compressed using the previous block (uncompressed) as the dictionary
+        ImageLinkedBlockResponse = 0x16
+
+        # original_size: u16, word: u16
+        # original_size bytes of the same 16-bit word (first byte in the lower half), not limited by the block size
+        ImageFillBlockResponse = 0x17
+
+        # version: u8, payload_size: u16, followed by the payload:
+        # fg_valid: u8, runtime_to_empty: u32, runtime_to_full: u32, charge_percentage: u8, voltage: u32,
+        # fingerprint: u32, codecs: u8, pixel_formats: u8, max_block_size: u16, features: u32,
+        # tile_cache_slots: u16 (optional), forced_cutoffs: u16 (optional)
+        # Newer clients might append more fields, they are skipped based on the payload size.
+        GetImageRequestV2 = 0x18
+
+        # version: u8, payload_size: u16, followed by the payload:
+        # codecs: u8, pixel_format: u8, block_size: u16, features: u32
+        # Server choices for the current session, followed by one of the responses to the GetImageRequest
+        SessionResponse = 0x19
+
+        # update_type: u8, width: u16, height: u16, tile_width: u8, tile_height: u8, fingerprint: u32
+        # The width is in bytes, the tile size in pixels. Followed by a tile band response for every row of tiles.
+        ImageTiledResponse = 0x1A
+
+        # num_new_tiles: u16, num_blocks: u16, new_tile_slots: u8 * num_new_tiles
+        # Followed by num_blocks image block responses with the new tiles (whole tiles only), and the slot of every tile
+        # in the band: u8 * number of tile columns
+        TileBandResponse = 0x1B
+
         # No payload
         ServerError = 0x50
 
@@ -42,6 +85,38 @@ class Message:
         writer.write(encode([U8(self.message_type.value)] + self.values))
 
 
+class Capabilities:
+    """ Bitmasks exchanged during the version negotiation """
+
+    class Codec(IntFlag):
+        # LZ4 blocks compressed using the previous block as the dictionary
+        LinkedBlocks = 0x01
+
+        # Runs of a repeated 16-bit word
+        FillBlocks = 0x02
+
+    class PixelFormat(IntFlag):
+        # Bit positions match the IT8951 pixel format values
+        PF2BPP = 0x01
+        PF3BPP = 0x02
+        PF4BPP = 0x04
+        PF8BPP = 0x08
+
+        @property
+        def value_index(self) -> int:
+            return self.value.bit_length() - 1
+
+    class Feature(IntFlag):
+        # Skip sending the image, if the client already shows it
+        NotModified = 0x01
+
+        # Send only the changed areas of the image
+        DeltaUpdates = 0x02
+
+        # Send every unique tile of the image only once
+        TiledFrames = 0x04
+
+
 @dataclass
 class GetImageRequest(Message):
     fuel_gauge_valid: bool  # u8
@@ -50,6 +125,16 @@ class GetImageRequest(Message):
     charge_percentage: int  # u8
     voltage: int  # u32
 
+    # Not part of the legacy request, legacy clients get the baseline behaviour
+    fingerprint: int = 0  # u32
+    codecs: Capabilities.Codec = Capabilities.Codec(0)  # u8
+    pixel_formats: Capabilities.PixelFormat = Capabilities.PixelFormat.PF4BPP  # u8
+    max_block_size: int = 4096  # u16
+    features: Capabilities.Feature = Capabilities.Feature(0)  # u32
+    tile_cache_slots: int = 0  # u16
+    forced_cutoffs: int = 0  # u16, times the power board had to cut the power on its own
+    version: int = 1
+
     @staticmethod
     async def read(reader: asyncio.StreamReader, timeout) -> 'GetImageRequest':
         # The rest of the fields we still have to read
@@ -58,9 +143,104 @@ class GetImageRequest(Message):
         payload = decode(payload_bytes, [U8, U32, U32, U8, U32])
         return GetImageRequest(payload[0] != 0, payload[1], payload[2], payload[3], payload[4])
 
+    @staticmethod
+    async def read_v2(reader: asyncio.StreamReader, timeout) -> 'GetImageRequest':
+        version, payload_size = decode(await asyncio.wait_for(reader.readexactly(1 + 2), timeout), [U8, U16])
+        payload_bytes = await asyncio.wait_for(reader.readexactly(payload_size), timeout)
+
+        fields = [U8, U32, U32, U8, U32, U32, U8, U8, U16, U32]
+        known_size = 1 + 4 + 4 + 1 + 4 + 4 + 1 + 1 + 2 + 4
+        if payload_size < known_size:
+            raise struct.error(f'Request payload too short: {payload_size}')
+
+        payload = decode(payload_bytes[:known_size], fields)
+
+        # Optional fields, added after the initial version 2
+        tile_cache_slots = 0
+        if payload_size >= known_size + 2:
+            tile_cache_slots = decode(payload_bytes[known_size:known_size + 2], [U16])[0]
+
+        forced_cutoffs = 0
+        if payload_size >= known_size + 2 + 2:
+            forced_cutoffs = decode(payload_bytes[known_size + 2:known_size + 4], [U16])[0]
+
+        return GetImageRequest(payload[0] != 0, payload[1], payload[2], payload[3], payload[4], payload[5],
+                               Capabilities.Codec(payload[6]), Capabilities.PixelFormat(payload[7]), payload[8],
+                               Capabilities.Feature(payload[9]), tile_cache_slots, forced_cutoffs, version)
+
+
+@dataclass
+class Session:
+    """ What the server has chosen for the current client """
+    version: int
+    codecs: Capabilities.Codec
+    pixel_format: Capabilities.PixelFormat
+    block_size: int
+    features: Capabilities.Feature
+    tile_cache_slots: int = 0
+
+    # Newest protocol version supported by the server
+    VERSION = 2
+
+    SUPPORTED_CODECS = Capabilities.Codec.LinkedBlocks | Capabilities.Codec.FillBlocks
+    SUPPORTED_FEATURES = (Capabilities.Feature.NotModified | Capabilities.Feature.DeltaUpdates |
+                          Capabilities.Feature.TiledFrames)
+
+    # Hosted images are always 4bpp
+    PIXEL_FORMAT = Capabilities.PixelFormat.PF4BPP
+
+    # Smaller blocks are possible, but are not worth the overhead
+    MIN_BLOCK_SIZE = 512
+
+    @property
+    def encoding(self) -> HostedImage.Encoding:
+        return HostedImage.Encoding(Capabilities.Codec.LinkedBlocks in self.codecs, self.block_size,
+                                    Capabilities.Codec.FillBlocks in self.codecs)
+
+    @staticmethod
+    def negotiate(request: GetImageRequest) -> Optional['Session']:
+        """
+        :return: The session parameters, or None if the client doesn't support anything we can offer
+        """
+        if Session.PIXEL_FORMAT not in request.pixel_formats:
+            Log.warning(f'No supported pixel formats: {request.pixel_formats!r}')
+            return None
+
+        block_size = min(request.max_block_size, HostedImage.Block.SIZE)
+        if block_size < Session.MIN_BLOCK_SIZE:
+            Log.warning(f'Block size too small: {request.max_block_size}')
+            return None
+
+        features = request.features & Session.SUPPORTED_FEATURES
+        tile_cache_slots = min(request.tile_cache_slots, TiledFrame.MAX_SLOTS)
+        if tile_cache_slots == 0:
+            features &= ~Capabilities.Feature.TiledFrames
+
+        return Session(min(request.version, Session.VERSION), request.codecs & Session.SUPPORTED_CODECS,
+                       Session.PIXEL_FORMAT, block_size, features, tile_cache_slots)
+
+    @staticmethod
+    def legacy() -> 'Session':
+        return Session(1, Capabilities.Codec(0), Session.PIXEL_FORMAT, HostedImage.Block.SIZE, Capabilities.Feature(0))
+
+
+class SessionMessage(Message):
+    """
+    | Message Type | Version | Payload Size | Codecs | Pixel Format | Block Size | Features | Time of Day | Next Wake |
+    """
+
+    def __init__(self, session: Session, next_wake: int):
+        """ :param next_wake: Seconds until the next known change, the client won't sleep past it (0 - none) """
+        # Seconds since the local midnight, the power board keeps the quiet hours with it
+        now = datetime.now()
+        time_of_day = now.hour * 3600 + now.minute * 60 + now.second
+        super().__init__(Message.Type.SessionResponse, U8(session.version), U16(1 + 1 + 2 + 4 + 4 + 4),
+                         U8(session.codecs.value), U8(session.pixel_format.value_index), U16(session.block_size),
+                         U32(session.features.value), U32(time_of_day), U32(next_wake))
+
 
 class ImageHeaderMessage(Message):
-    """ | Message Type | Update Type | Width | Height | Num image blocks | """
+    """ | Message Type | Update Type | Width | Height | Num image blocks | Fingerprint | """
 
     class UpdateType(Enum):
         Init = 0
@@ -69,16 +249,65 @@ class ImageHeaderMessage(Message):
         GL16 = 3
         GLR16 = 4
 
+    def __init__(self, update_type: 'ImageHeaderMessage.UpdateType', image: HostedImage, num_blocks: int,
+                 legacy: bool = False):
+        values = [U8(update_type.value), U16(image.width), U16(image.height), U16(num_blocks)]
+        if not legacy:
+            values.append(U32(image.fingerprint))
+        super().__init__(Message.Type.ImageHeaderResponse, *values)
+
+
+class ImageDeltaMessage(Message):
+    """ | Message Type | Update Type | Num areas | Fingerprint | """
+
+    def __init__(self, update_type: 'ImageHeaderMessage.UpdateType', delta: ImageDelta, image: HostedImage):
+        super().__init__(Message.Type.ImageDeltaResponse, U8(update_type.value), U16(len(delta.areas)),
+                         U32(image.fingerprint))
+
+
+class ImageTiledMessage(Message):
+    """ | Message Type | Update Type | Width | Height | Tile Width | Tile Height | Fingerprint | """
+
     def __init__(self, update_type: 'ImageHeaderMessage.UpdateType', image: HostedImage):
-        super().__init__(Message.Type.ImageHeaderResponse, U8(update_type.value), U16(image.width), U16(image.height),
-                         U16(len(image.blocks)))
+        super().__init__(Message.Type.ImageTiledResponse, U8(update_type.value), U16(image.width), U16(image.height),
+                         U8(TiledFrame.TILE_WIDTH), U8(TiledFrame.TILE_HEIGHT), U32(image.fingerprint))
+
+
+class TileBandMessage(Message):
+    """ | Message Type | Num new tiles | Num image blocks | New tile slots | """
+
+    def __init__(self, band: TiledFrame.Band):
+        super().__init__(Message.Type.TileBandResponse, U16(len(band.new_slots)), U16(len(band.blocks)))
+        self.band = band
+
+    async def write(self, writer: asyncio.StreamWriter):
+        await super().write(writer)
+        writer.write(bytes(self.band.new_slots))
+        for block in self.band.blocks:
+            await ImageBlockMessage(block).write(writer)
+        writer.write(bytes(self.band.tile_map))
+
+
+class ImageAreaMessage(Message):
+    """ | Message Type | X | Y | Width | Height | Num image blocks | """
+
+    def __init__(self, area: HostedImage.Area, num_blocks: int):
+        super().__init__(Message.Type.ImageAreaResponse, U16(area.x), U16(area.y), U16(area.width), U16(area.height),
+                         U16(num_blocks))
 
 
 class ImageBlockMessage(Message):
-    """ | Message Type | Uncompressed Size | Compressed Size | Data | """
+    """
+    | Message Type | Uncompressed Size | Compressed Size | Data |
+    | Message Type | Uncompressed Size | Fill Word |
+    """
 
     def __init__(self, block: HostedImage.Block):
-        super().__init__(Message.Type.ImageBlockResponse, U16(block.uncompressed_size), U16(block.size))
+        if block.is_fill:
+            super().__init__(Message.Type.ImageFillBlockResponse, U16(block.uncompressed_size), U16(block.fill_word))
+        else:
+            message_type = Message.Type.ImageLinkedBlockResponse if block.linked else Message.Type.ImageBlockResponse
+            super().__init__(message_type, U16(block.uncompressed_size), U16(block.size))
         self.data = block.data
 
     async def write(self, writer: asyncio.StreamWriter):
@@ -86,6 +315,13 @@ class ImageBlockMessage(Message):
         writer.write(self.data)
 
 
+class ImageNotModifiedMessage(Message):
+    """ | Message Type | """
+
+    def __init__(self):
+        super().__init__(Message.Type.ImageNotModified)
+
+
 class ServerErrorMessage(Message):
     """ | Message Type | """
 
@@ -99,19 +335,43 @@ class Server:
         port: int
         client_timeout: int
 
+        # Times of day at which the content is known to change (e.g. a calendar switching to the next day)
+        change_times: list[time] = field(default_factory=list)
+
         @staticmethod
         def add_arguments(parser: argparse.ArgumentParser):
             parser.add_argument('--port', '-p', type=int, default=8765, help='Server listen port')
             parser.add_argument('--client-timeout', '-t', type=int, default=15, help='Client timeout in seconds')
+            parser.add_argument('--change-at', type=time.fromisoformat, action='append', dest='change_times',
+                                default=[], metavar='HH:MM',
+                                help='Time of day at which the content changes, the clients wake up for it instead '
+                                     'of waiting for their refresh interval. Can be repeated.')
 
         @staticmethod
         def from_args(args) -> 'Server.Config':
-            return Server.Config(args.port, args.client_timeout)
+            return Server.Config(args.port, args.client_timeout, args.change_times)
+
+    # Number of recently sent images to keep around for computing deltas
+    SENT_IMAGES_HISTORY = 8
+
+    # Let the clients wake up a bit after the screenshot of a change is taken, and not right before it
+    NEXT_WAKE_MARGIN = 5
 
     def __init__(self, server_config: 'Server.Config', capture_config: CaptureConfig):
         self.image_capture = ImageCapture(capture_config)
         self.server_config = server_config
         self.server = None
+        self.sent_images = OrderedDict()  # type: OrderedDict[int, HostedImage]
+
+        # The latest screenshot is only encoded once (per capture generation), and shared between all the requests
+        self.encode_lock = asyncio.Lock()
+        self.hosted_image = None  # type: Optional[HostedImage]
+        self.hosted_generation = None  # type: Optional[int]
+
+        # Deltas between the previously sent images and the hosted image, keyed by (previous, current) fingerprints
+        self.deltas = {}  # type: Dict[tuple[int, int], Optional[ImageDelta]]
+
+        self.image_capture.add_listener(self._on_new_screenshot)
 
     @property
     def timeout(self):
@@ -159,7 +419,8 @@ class Server:
                     handlers: Dict[
                         Message.Type, Callable[[asyncio.StreamReader, asyncio.StreamWriter], Awaitable[None]]] = \
                         {
-                            Message.Type.GetImageRequest: self._handle_get_image,
+                            Message.Type.GetImageRequest: self._handle_get_image_legacy,
+                            Message.Type.GetImageRequestV2: self._handle_get_image,
                         }
 
                     if message_type not in handlers:
@@ -187,30 +448,148 @@ class Server:
                 Log.error(f"Error closing connection to {addr}: {e}")
             Log.info(f"Connection from {addr} closed")
 
+    async def _on_new_screenshot(self):
+        # Encode right away, so that the clients don't have to wait for it
+        await self._latest_image()
+
+    async def _latest_image(self) -> Optional[HostedImage]:
+        async with self.encode_lock:
+            generation = self.image_capture.generation
+            if generation == self.hosted_generation:
+                return self.hosted_image
+
+            screenshot = self.image_capture.latest_screenshot
+            if screenshot is None:
+                return None
+
+            image = await HostedImage.from_image(screenshot)
+
+            # Linked and fill blocks are what the current firmware asks for
+            await image.encode(HostedImage.Encoding(linked=True, fill=True))
+
+            Log.info(f'Encoded capture #{generation}: {image.fingerprint:08x}')
+            self.hosted_image = image
+            self.hosted_generation = generation
+            self.deltas.clear()
+            return image
+
+    async def _delta(self, previous: HostedImage, image: HostedImage) -> Optional[ImageDelta]:
+        key = (previous.fingerprint, image.fingerprint)
+        if key not in self.deltas:
+            self.deltas[key] = await ImageDelta.compute(previous, image)
+        return self.deltas[key]
+
+    def _remember_sent_image(self, image: HostedImage):
+        self.sent_images[image.fingerprint] = image
+        self.sent_images.move_to_end(image.fingerprint)
+        while len(self.sent_images) > Server.SENT_IMAGES_HISTORY:
+            self.sent_images.popitem(last=False)
+
+    async def _send_delta(self, writer, update_type, previous: HostedImage, image: HostedImage,
+                          session: Session) -> bool:
+        delta = await self._delta(previous, image)
+        if delta is None:
+            return False
+
+        Log.info(f'Sending {len(delta.areas)} changed areas')
+        await ImageDeltaMessage(update_type, delta, image).write(writer)
+        for area in delta.areas:
+            blocks = await area.encode(session.encoding)
+            await ImageAreaMessage(area, len(blocks)).write(writer)
+            for block in blocks:
+                await ImageBlockMessage(block).write(writer)
+
+        return True
+
+    async def _send_tiled(self, writer, update_type, image: HostedImage, blocks: list[HostedImage.Block],
+                          session: Session) -> bool:
+        if Capabilities.Feature.TiledFrames not in session.features:
+            return False
+
+        frame = await image.encode_tiled(session.tile_cache_slots, session.block_size)
+        if frame is None:
+            return False
+
+        # Only worth it if the tiles are smaller than the block stream
+        blocks_size = sum(1 + 2 + 2 + x.size for x in blocks)
+        if frame.size >= blocks_size:
+            return False
+
+        Log.info(f'Sending tiled frame: {frame.size} / {blocks_size} bytes')
+        await ImageTiledMessage(update_type, image).write(writer)
+        for band in frame.bands:
+            await TileBandMessage(band).write(writer)
+
+        return True
+
+    def _next_wake(self) -> int:
+        """ :return: Seconds until the next known change is captured, 0 if there is none """
+        if not self.server_config.change_times:
+            return 0
+
+        now = datetime.now()
+        changes = []
+        for change_time in self.server_config.change_times:
+            change = datetime.combine(now.date(), change_time)
+            if change <= now:
+                change += timedelta(days=1)
+            changes.append(change)
+
+        # The change only shows up with the next screenshot after it
+        seconds = (min(changes) - now).total_seconds()
+        seconds += self.image_capture.config.capture_interval or 0
+        return int(seconds) + Server.NEXT_WAKE_MARGIN
+
     async def _send_server_error(self, writer):
         await ServerErrorMessage().write(writer)
         await asyncio.wait_for(writer.drain(), timeout=self.server_config.client_timeout)
 
-    async def _handle_get_image(self, reader, writer):
+    async def _handle_get_image_legacy(self, reader, writer):
         request = await GetImageRequest.read(reader, self.timeout)
+        await self._serve_image(writer, request, Session.legacy())
+
+    async def _handle_get_image(self, reader, writer):
+        request = await GetImageRequest.read_v2(reader, self.timeout)
+
+        session = Session.negotiate(request)
+        if session is None:
+            return await self._send_server_error(writer)
 
+        Log.info(f"Session: {session}")
+        await SessionMessage(session, self._next_wake()).write(writer)
+        await self._serve_image(writer, request, session)
+
+    async def _serve_image(self, writer, request: GetImageRequest, session: Session):
         Log.info(f"Get image request: {request}")
+        if request.forced_cutoffs:
+            Log.warning(f'The power board had to cut the power {request.forced_cutoffs} times, '
+                        f'consider increasing its awake budget')
 
         # TODO: Post fuel gauge values into MQTT
 
         # TODO: Decide on refresh type and post it as a parameter
         update_type = ImageHeaderMessage.UpdateType.GC16
 
-        screenshot = self.image_capture.latest_screenshot
-        if screenshot is None:
+        image = await self._latest_image()
+        if image is None:
             Log.error('No screenshot available')
             return await self._send_server_error(writer)
-
-        image = await HostedImage.from_image(self.image_capture.latest_screenshot)
-        await ImageHeaderMessage(update_type, image).write(writer)
-
-        for block in image.blocks:
-            await ImageBlockMessage(block).write(writer)
+        if Capabilities.Feature.NotModified in session.features and request.fingerprint == image.fingerprint:
+            Log.info('Image not modified')
+            await ImageNotModifiedMessage().write(writer)
+            return await asyncio.wait_for(writer.drain(), timeout=self.server_config.client_timeout)
+
+        # If we know what the client is showing right now, only send the changed areas
+        previous = self.sent_images.get(request.fingerprint)
+        self._remember_sent_image(image)
+        if (Capabilities.Feature.DeltaUpdates not in session.features or previous is None or
+                not await self._send_delta(writer, update_type, previous, image, session)):
+            blocks = await image.encode(session.encoding)
+            if not await self._send_tiled(writer, update_type, image, blocks, session):
+                await ImageHeaderMessage(update_type, image, len(blocks), legacy=session.version < 2).write(writer)
+
+                for block in blocks:
+                    await ImageBlockMessage(block).write(writer)
 
         await asyncio.wait_for(writer.drain(), timeout=self.server_config.client_timeout)
 